@@ -0,0 +1,199 @@
+#include "capture.h"
+#include "mqtt.h"
+#include "logger.h"
+
+#include <string.h>
+#include <ctype.h>
+
+#include <cerrno>
+#include <atomic>
+#include <mutex>
+
+// Capture is started and stopped from render threads, while
+// messages are recorded from the MQTT thread
+static std::mutex captureMutex;
+static std::atomic<bool> captureActive{false};
+static FILE *captureFile = NULL;
+static char *captureBuffer = NULL;
+static steady_clock::time_point captureStart;
+static steady_clock::time_point nextFlushTime;
+static uint32_t captureCount = 0;
+static size_t captureSize = 0;
+
+
+// Start recording messages to a file, replacing any capture
+// in progress.  Writes are buffered and flushed periodically
+// so recording doesn't add a syscall to every message.
+static void closeCapture(void)
+{
+  if (captureFile == NULL)
+    return;
+
+  captureActive = false;
+  fclose(captureFile);
+  captureFile = NULL;
+  delete[] captureBuffer;
+  captureBuffer = NULL;
+
+  _log("capture: stopped after %u messages", captureCount);
+}
+
+// Names are only letters, digits, '-', '_' and '.' (but not
+// leading), so they can't leave our capture directory
+static bool validCaptureName(const char *name)
+{
+  size_t len = strlen(name);
+  if (len == 0 || len > CAPTURE_NAME_LEN || name[0] == '.')
+    return false;
+
+  for (size_t i = 0; i < len; i++) {
+    if (!isalnum((unsigned char) name[i]) && !strchr("-_.", name[i]))
+      return false;
+  }
+  return true;
+}
+
+bool startCapture(const char *name)
+{
+  if (!validCaptureName(name)) {
+    _error("capture: invalid capture name, not recording");
+    return false;
+  }
+
+  char path[sizeof(CAPTURE_DIR) + CAPTURE_NAME_LEN + 1];
+  snprintf(path, sizeof(path), "%s/%s", CAPTURE_DIR, name);
+
+  std::lock_guard<std::mutex> lock(captureMutex);
+  closeCapture();
+
+  captureFile = fopen(path, "wb");
+  if (captureFile == NULL) {
+    _error("capture: unable to open %s: %s", path, strerror(errno));
+    return false;
+  }
+
+  captureBuffer = new char[CAPTURE_BUFFER_SIZE];
+  setvbuf(captureFile, captureBuffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+  CaptureFileHeader header;
+  header.magic = CAPTURE_MAGIC;
+  header.version = CAPTURE_VERSION;
+  header.started = std::chrono::duration_cast<milliseconds>(
+      system_clock::now().time_since_epoch()).count();
+  fwrite(&header, sizeof(header), 1, captureFile);
+
+  captureStart = steady_clock::now();
+  nextFlushTime = captureStart + CAPTURE_FLUSH_PERIOD;
+  captureCount = 0;
+  captureSize = sizeof(header);
+  captureActive = true;
+
+  _log("capture: recording messages to %s", path);
+  return true;
+}
+
+void stopCapture(void)
+{
+  std::lock_guard<std::mutex> lock(captureMutex);
+  closeCapture();
+}
+
+bool capturing(void)
+{
+  return captureActive;
+}
+
+// Record a message as it's dispatched, except for our own
+// capture control messages
+void captureMessage(const char *topic, const char *payload, int length)
+{
+  if (!captureActive || strcmp(topic, DEBUG_CAPTURE) == 0)
+    return;
+
+  std::lock_guard<std::mutex> lock(captureMutex);
+  if (captureFile == NULL)
+    return;
+
+  size_t recordSize = sizeof(CaptureRecord) + strlen(topic) + length;
+  if (captureSize + recordSize > CAPTURE_MAX_SIZE) {
+    _warn("capture: reached %d bytes, stopping", CAPTURE_MAX_SIZE);
+    closeCapture();
+    return;
+  }
+
+  CaptureRecord record;
+  record.time = std::chrono::duration_cast<milliseconds>(
+      steady_clock::now() - captureStart).count();
+  record.topicLength = strlen(topic);
+  record.payloadLength = length;
+
+  fwrite(&record, sizeof(record), 1, captureFile);
+  fwrite(topic, 1, record.topicLength, captureFile);
+  fwrite(payload, 1, length, captureFile);
+
+  if (ferror(captureFile)) {
+    _error("capture: write failed, stopping");
+    closeCapture();
+    return;
+  }
+  captureCount++;
+  captureSize += recordSize;
+}
+
+void checkFlushCapture(void)
+{
+  if (!captureActive)
+    return;
+
+  std::lock_guard<std::mutex> lock(captureMutex);
+  if (captureFile == NULL || steady_clock::now() < nextFlushTime)
+    return;
+
+  fflush(captureFile);
+  nextFlushTime = steady_clock::now() + CAPTURE_FLUSH_PERIOD;
+}
+
+
+CaptureReader::~CaptureReader()
+{
+  if (file)
+    fclose(file);
+}
+
+bool CaptureReader::open(const char *path)
+{
+  file = fopen(path, "rb");
+  if (file == NULL) {
+    _error("capture: unable to open %s: %s", path, strerror(errno));
+    return false;
+  }
+
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+    _error("capture: %s is not a version %d capture", path, CAPTURE_VERSION);
+    return false;
+  }
+  return true;
+}
+
+// Read the next message, returning false at the end of the
+// file.  A truncated last record (from a capture that was
+// still being written) is ignored.
+bool CaptureReader::next(CaptureMessage &msg)
+{
+  CaptureRecord record;
+
+  if (file == NULL || fread(&record, sizeof(record), 1, file) != 1)
+    return false;
+
+  msg.time = record.time;
+  msg.topic.resize(record.topicLength);
+  msg.payload.resize(record.payloadLength);
+
+  if (fread(msg.topic.data(), 1, record.topicLength, file) != record.topicLength ||
+      fread(msg.payload.data(), 1, record.payloadLength, file) != record.payloadLength) {
+    _warn("capture: ignoring truncated record");
+    return false;
+  }
+  return true;
+}
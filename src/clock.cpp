@@ -0,0 +1,186 @@
+#include "clock.h"
+#include "display.h"
+#include "datetime.h"
+#include "logger.h"
+#include "trace.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+ClockRenderer clockRenderer;
+
+extern uint8_t clockOffset;
+extern uint8_t clockWidth;
+extern uint8_t rowDayStart;
+extern uint8_t rowDateStart;
+extern uint8_t rowTimeStart;
+extern Color colorBlack, colorDate, colorTime;
+extern GirderFont *clockFont;
+
+
+// Rasterize the weekday names and clock glyphs, done
+// once on the first render after fonts are loaded
+void ClockRenderer::initSprites()
+{
+  char glyph[2] = {0, 0};
+  tm day = {};
+
+  for (int i = 0; i < 7; i++) {
+    day.tm_wday = i;
+    weekdays[i].rasterize(s_weekday(&day), clockFont, colorDate, 0, false);
+  }
+
+  for (int i = 0; i < CLOCK_NUM_GLYPHS; i++) {
+    glyph[0] = CLOCK_GLYPHS[i];
+    dateGlyphs[i].rasterize(glyph, clockFont, colorDate, 0, true);
+    timeGlyphs[i].rasterize(glyph, clockFont, colorTime, 0, true);
+  }
+
+  init = true;
+}
+
+TextRun* ClockRenderer::glyphSprite(TextRun *glyphs, char glyph)
+{
+  const char *pos = strchr(CLOCK_GLYPHS, glyph);
+  if (glyph == '\0' || pos == NULL) {
+    _warn("clock: no sprite for glyph '%c'", glyph);
+    return NULL;
+  }
+  return &glyphs[pos - CLOCK_GLYPHS];
+}
+
+// Lay out variable-width text centered in the clock,
+// matching the placement of drawText()
+void ClockRenderer::layoutGlyphs(ClockLine &line, TextRun *glyphs, const char *text)
+{
+  uint8_t renderLen = textRenderLength(text, clockFont);
+  int16_t x = clockOffset + (clockWidth / 2) - (renderLen / 2);
+
+  line.count = 0;
+  for (const char *glyph = text; *glyph && line.count < CLOCK_LINE_CELLS; glyph++)
+  {
+    TextRun *sprite = glyphSprite(glyphs, *glyph);
+    if (sprite) {
+      line.cells[line.count].sprite = sprite;
+      line.cells[line.count++].x = x;
+    }
+    x += vGlyphWidth(*glyph, clockFont);
+  }
+}
+
+// Erase the cells that changed from what is drawn on a
+// line, then draw the new ones.  All erasing is done first
+// so it can't clear pixels of a neighbouring new glyph.
+void ClockRenderer::updateLine(clockLineType type, ClockLine &line, uint8_t y)
+{
+  ClockLine &current = lines[type];
+
+  for (uint8_t i = 0; i < current.count; i++) {
+    if (i >= line.count || !(current.cells[i] == line.cells[i]))
+      current.cells[i].sprite->erase(canvas, current.cells[i].x, y);
+  }
+
+  for (uint8_t i = 0; i < line.count; i++) {
+    if (i >= current.count || !(current.cells[i] == line.cells[i]))
+      line.cells[i].sprite->blit(canvas, line.cells[i].x, y);
+  }
+
+  current = line;
+}
+
+// Show seconds as a bar along the bottom of the clock,
+// extended by a pixel every couple of seconds
+void ClockRenderer::updateSeconds(uint8_t second, bool force)
+{
+  int8_t x = (second + 1) * clockWidth / 60 - 1;
+
+  if (force || x < secondsX) {
+    drawRect(clockOffset, CLOCK_SECONDS_ROW, clockWidth, 1, colorBlack);
+    secondsX = -1;
+  }
+
+  for (int8_t px = secondsX + 1; px <= x; px++)
+    canvas->SetPixel(clockOffset + px, CLOCK_SECONDS_ROW,
+        colorDate.r, colorDate.g, colorDate.b);
+  secondsX = x;
+}
+
+// Show the day of week, date and time.  Until the next minute
+// (or second) this only compares the time to our next update.
+void ClockRenderer::render(bool force)
+{
+  auto now = (fixedTime == system_clock::time_point()) ?
+      system_clock::now() : fixedTime;
+  if (now < nextUpdate && !force)
+    return;
+
+  TRACE_SPAN("displayClock");
+  if (!init)
+    initSprites();
+
+  ClockLine line;
+  char buffer[6];
+  time_t local = system_clock::to_time_t(now);
+  tm localtm;
+  localtime_r(&local, &localtm);
+
+  // Clear the widget, and anything we have drawn
+  if (force) {
+    drawRect(clockOffset, 0, clockWidth, 32, colorBlack);
+    for (auto &l : lines)
+      l.count = 0;
+    secondsX = -1;
+  }
+
+  // Day of week
+  line.count = 1;
+  line.cells[0].sprite = &weekdays[localtm.tm_wday];
+  line.cells[0].x = clockOffset + (int8_t) ((clockWidth -
+      (strlen(s_weekday(&localtm)) * FONT_CLOCK_WIDTH)) / 2);
+  updateLine(LINE_DAY, line, rowDayStart);
+
+  // Date
+  snprintf(buffer, 6, "%d/%d", month(&localtm), day(&localtm));
+  layoutGlyphs(line, dateGlyphs, buffer);
+  updateLine(LINE_DATE, line, rowDateStart);
+
+  // Time
+  snprintf(buffer, 6, "%d:%02d", hour(&localtm), minute(&localtm));
+  layoutGlyphs(line, timeGlyphs, buffer);
+  updateLine(LINE_TIME, line, rowTimeStart);
+
+  if (showSeconds) {
+    updateSeconds(second(&localtm), force);
+    nextUpdate = std::chrono::floor<std::chrono::seconds>(now) + 1s;
+  } else {
+    nextUpdate = std::chrono::floor<std::chrono::minutes>(now) + 1min;
+  }
+}
+
+void ClockRenderer::setShowSeconds(bool value)
+{
+  if (showSeconds && !value)
+    drawRect(clockOffset, CLOCK_SECONDS_ROW, clockWidth, 1, colorBlack);
+
+  showSeconds = value;
+  secondsX = -1;
+  nextUpdate = system_clock::time_point();
+}
+
+// Always show the given time (or the current time again if
+// zero), used by tools that need reproducible frames
+void ClockRenderer::setFixedTime(system_clock::time_point time)
+{
+  fixedTime = time;
+  nextUpdate = system_clock::time_point();
+}
+
+// Time until the clock next changes, so the main
+// loop can wake up for it instead of polling
+milliseconds ClockRenderer::nextUpdateIn()
+{
+  auto wait = std::chrono::ceil<milliseconds>(nextUpdate - system_clock::now());
+  return std::max(wait, 0ms);
+}
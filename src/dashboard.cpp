@@ -6,11 +6,20 @@
 #include "weatherwidget.h"
 #include "icons.h"
 #include "mqtt.h"
+#include "trace.h"
+#include "state.h"
+#include "iconcache.h"
+#include "json.h"
+#include "capture.h"
+#include "statestore.h"
+#include "clock.h"
+#include "page.h"
 
 #include <mosquitto.h>
 #include <unistd.h>
 
 #include <cstring>
+#include <algorithm>
 
 
 char weatherCondition[WEATHER_MAX_LEN+1] = "";
@@ -48,6 +57,11 @@ uint8_t rowThreeStart = rowTwoStart + FONT_DEFAULT_HEIGHT + rowSpacing;
 uint8_t rowCalendarStart = rowThreeStart + (FONT_DEFAULT_HEIGHT + rowSpacing) + 8;
 uint8_t rowWeatherAlertStart = rowCalendarStart + (FONT_DEFAULT_HEIGHT + rowSpacing);
 
+// Home page
+uint8_t homeOffset = 1;
+uint8_t homeTrendOffset = homeOffset + WIDGET_WIDTH_SMALL + 4;
+uint8_t rowChoresStart = rowThreeStart + (FONT_DEFAULT_HEIGHT + rowSpacing);
+
 // *TODO*: Wire up photocell and use to determine brightness
 // Control brightness by adjusting RGB values. Brightness is a
 // percentage so brightness=50 turns 250,250,250 into 125,125,125
@@ -68,24 +82,47 @@ WeatherWidget wOutdoorWeather("outdoorWeather");
 WeatherWidget wOutdoorForecast("outdoorForecast");
 MultilineWidget wCalendar("calendar");
 MultilineWidget wWeatherAlerts("weatherAlerts");
+DashboardWidget wHouseVOC("houseVOC");
+DashboardWidget wGarageDoor("garageDoor");
+MultilineWidget wChores("chores");
+TrendWidget wOutdoorTempTrend("outdoorTempTrend");
+TrendWidget wHouseTempTrend("houseTempTrend");
 
 // TODO: fix this, eg: add a widget manager
 DashboardWidget *widget;
 WidgetManager widgets;
+WidgetManager homeWidgets;
+DashboardLayout dashboardLayout;
+
+// Weather and the clock, and things around the house
+Page mainPage("main", &widgets, true);
+Page homePage("home", &homeWidgets);
 
 GirderFont *largeFont, *smallFont;
 
 extern uint32_t cycle;
 extern bool forceRefresh;
+extern st_mqttClient mqtt;
 extern milliseconds refreshActiveDelay;
 extern rgb_matrix::Color colorText, colorTextDay, colorTextNight;
 extern rgb_matrix::Color colorWhite, colorGrey, colorTextDark, colorAlert;
 extern GirderFont *defaultFont;
 
 
+static void setupSlots();
+static void applyStoreUpdates();
+
 void setupDashboard()
 {
   _log("configuring dashboard");
+  setupSlots();
+  pageManager.addPage(&mainPage);
+  pageManager.addPage(&homePage);
+
+  // Start decoding our icons in the background, they are
+  // waited for as each widget is configured below
+  preloadIcons({ICON_RAIN_GAUGE, ICON_WIND, ICON_WEATHER_PCLOUDY,
+      ICON_CALENDAR, ICON_ALERT, ICON_LIGHTNING_BOLT, ICON_WEATHER_UNKNOWN});
 
   // Row 1
   // Living room temperature
@@ -98,6 +135,7 @@ void setupDashboard()
   widget->setIconOrigin(0, 1);
   widget->setVisibleTextLength(3);
   // widget->setDebug(true);
+  widget->trackHistory();
   widgets.addWidget(widget);
 
   // Living room dewpoint
@@ -110,6 +148,7 @@ void setupDashboard()
   widget->setIconOrigin(1, 1);
   widget->setVisibleTextLength(3);
   // widget->setDebug(true);
+  widget->trackHistory();
   widgets.addWidget(widget);
 
   // Row 2
@@ -124,6 +163,7 @@ void setupDashboard()
   widget->updateText((char *)"--", false);
   widget->setVisibleTextLength(3);
   // widget->setDebug(true);
+  widget->trackHistory();
   widgets.addWidget(widget);
 
   // Dewpoint
@@ -135,6 +175,7 @@ void setupDashboard()
   widget->setIconImage(8, 8, droplet);
   widget->setVisibleTextLength(3);
   // widget->setDebug(true);
+  widget->trackHistory();
   widgets.addWidget(widget);
 
   // Row 3
@@ -149,6 +190,7 @@ void setupDashboard()
   widget->updateText((char *)"--", false);
   widget->setVisibleTextLength(3);
   // widget->setDebug(true);
+  widget->trackHistory();
   widgets.addWidget(widget);
 
   // PM2.5
@@ -160,10 +202,12 @@ void setupDashboard()
   widget->setIconImage(7, 8, air);
   widget->setVisibleTextLength(3);
   widget->setAlertLevel(20.0, colorAlert);
+  widget->trackHistory();
   widgets.addWidget(widget);
 
   // Primary Weather Widget
-  largeFont = new GirderFont(GirderFont::FONT_LARGE);
+  largeFont = new GirderFont();
+  largeFont->LoadFontAsync(GirderFont::FONT_LARGE);
   widget = &wOutdoorWeather;
   widget->setOrigin(weatherOffsetX, weatherOffsetY);
   widget->setSize(DashboardWidget::WIDGET_LARGE);
@@ -172,10 +216,19 @@ void setupDashboard()
     colorWhite, DashboardWidget::ALIGN_CENTER, largeFont);
   widget->setVisibleTextLength(3);
   // widget->setDebug(true);
+  widget->trackHistory();
+  widgets.addWidget(widget);
+
+  // Outdoor temperature trend, left of the current weather
+  widget = &wOutdoorTempTrend;
+  widget->setOrigin(0, weatherOffsetY + rowTempStart);
+  widget->setBounds(5, 7);
+  wOutdoorTempTrend.setSource(wOutdoorWeather.getHistory(), 2.0);
   widgets.addWidget(widget);
 
   // Alternate forecast widget, to show over current weather
-  smallFont = new GirderFont(GirderFont::FONT_SMALL);
+  smallFont = new GirderFont();
+  smallFont->LoadFontAsync(GirderFont::FONT_SMALL);
   widget = &wOutdoorForecast;
   widget->setOrigin(weatherOffsetX, weatherOffsetY);
   widget->setSize(DashboardWidget::WIDGET_LARGE);
@@ -185,6 +238,7 @@ void setupDashboard()
     smallFont);
   widget->setVariableWidth(true);
   widget->setActive(false);
+  widget->setZOrder(1);
   widget->setVisibleTextLength(5);
   // widget->setDebug(true);
   widgets.addWidget(widget);
@@ -198,6 +252,7 @@ void setupDashboard()
     colorText, DashboardWidget::ALIGN_LEFT, smallFont);
   widget->setVariableWidth(true);
   widget->setVisibleTextLength(20);
+  widget->setScrollText(true);
   // widget->setDebug(true);
   widgets.addWidget(widget);
 
@@ -210,224 +265,548 @@ void setupDashboard()
     colorText, DashboardWidget::ALIGN_LEFT, smallFont);
   widget->setVariableWidth(true);
   widget->setVisibleTextLength(20);
+  widget->setScrollText(true);
   // widget->setDebug(true);
   widgets.addWidget(widget);
+
+  // Home page, only shown in rotation once it has data
+  // Living room VOC index
+  widget = &wHouseVOC;
+  widget->setOrigin(homeOffset, rowOneStart);
+  widget->setSize(DashboardWidget::WIDGET_SMALL);
+  widget->autoTextConfig();
+  widget->setVariableWidth(true);
+  widget->setIconImage(7, 7, plant);
+  widget->setIconOrigin(0, 1);
+  widget->setVisibleTextLength(3);
+  widget->setAlertLevel(250.0, colorAlert);
+  widget->trackHistory();
+  homeWidgets.addWidget(widget);
+
+  // Living room temperature trend, and its range over the day
+  widget = &wHouseTempTrend;
+  widget->setOrigin(homeTrendOffset, rowOneStart);
+  widget->setBounds(WIDGET_WIDTH_LONG - homeTrendOffset, WIDGET_HEIGHT_SMALL);
+  widget->setCustomTextConfig(0, 0, colorText, DashboardWidget::ALIGN_LEFT);
+  widget->setVariableWidth(true);
+  wHouseTempTrend.setSource(wHouseTemp.getHistory(), 1.0);
+  wHouseTempTrend.setRange(24h);
+  homeWidgets.addWidget(widget);
+
+  // Garage door
+  widget = &wGarageDoor;
+  widget->setOrigin(homeOffset, rowTwoStart);
+  widget->setSize(DashboardWidget::WIDGET_LONG);
+  widget->setIconImage(8, 8, car);
+  widget->setCustomTextConfig(WIDGET_WIDTH_LONG, 0,
+    colorText, DashboardWidget::ALIGN_LEFT, smallFont);
+  widget->setVariableWidth(true);
+  widget->setVisibleTextLength(20);
+  homeWidgets.addWidget(widget);
+
+  // Chores/reminders, one per line
+  widget = &wChores;
+  widget->setOrigin(homeOffset, rowChoresStart);
+  widget->setSize(DashboardWidget::WIDGET_LONG);
+  widget->setIconImage(9, 8, ICON_CALENDAR);
+  widget->setCustomTextConfig(WIDGET_WIDTH_LONG, 0,
+    colorText, DashboardWidget::ALIGN_LEFT, smallFont);
+  widget->setVariableWidth(true);
+  widget->setVisibleTextLength(20);
+  widget->setScrollText(true);
+  homeWidgets.addWidget(widget);
 }
 
-// Render active widgets
-void displayDashboard(bool force)
+// Draw one frame of our pages: widgets updated by messages
+// and any dynamic widgets that are due.  Called by the render
+// thread of our panel, and by tools rendering offscreen.
+void renderFrame()
 {
-  widgets.displayDashboard();
-  displayClock(force);
+  applyStoreUpdates();
+
+  // Force refresh of the display
+  if (forceRefresh)
+    _log("forcing dashboard refresh");
+
+  pageManager.render(canvas, forceRefresh);
+  forceRefresh = false;
+  animScheduler.endFrame();
+  presentDisplay();
 }
 
-// Callback after message arriving on topic
-void mqttOnMessage(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg)
+void DashboardLayout::render()
 {
-  char *topic, *payload;
-  int length;
+  renderFrame();
+}
 
-  topic = msg->topic;
-  length = msg->payloadlen;
-  payload = (char *)msg->payload;
+milliseconds DashboardLayout::nextUpdateIn()
+{
+  if (forceRefresh)
+    return 0ms;
+  return pageManager.nextUpdateIn();
+}
 
-  char payloadAsChars[length];
-  for (int i = 0; i < length; i++) {
-    payloadAsChars[i] = (char)payload[i];
-  }
-  payloadAsChars[length] = '\0';
+void DashboardLayout::logStats()
+{
+  animScheduler.logStats();
+}
+
+/*
+  ----==== [ MQTT Message Handlers ] ====----
 
-  /*
   To add:
   - Indoor PM (need to build)
-  - Indoor VOC (need to build)
+  - Indoor VOC (done, home page)
   - Outdoor AQI? (eh, PM is there and covers it)
   - Pressure?
   - Weather alerts (in progress)
   - Calendar notifications (done)
-  - Garage door open?
-  - Chores/reminders
+  - Garage door open? (done, home page)
+  - Chores/reminders (done, home page)
   - Other TBD alerts?
-  */
+*/
 
-  // Home Assistant: Outdoor temperature
-  if (strcmp(topic, HASS_OUT_TEMP) == 0)
-  {
-    showMessage(topic, payloadAsChars);
-    wOutdoorWeather.updateText(payloadAsChars, tempIntHelper);
-  }
+// Home Assistant: Outdoor temperature
+static void handleOutdoorTemp(char *payload)
+{
+  wOutdoorWeather.updateText(payload, tempIntHelper);
+}
 
-  // Home Assistant: Outdoor dewpoint
-  else if (strcmp(topic, HASS_OUT_DEW) == 0)
-  {
-    showMessage(topic, payloadAsChars);
-    wOutdoorDewpoint.updateText(payloadAsChars, tempC2FHelper);
-  }
+// Home Assistant: Outdoor dewpoint
+static void handleOutdoorDewpoint(char *payload)
+{
+  wOutdoorDewpoint.updateText(payload, tempC2FHelper);
+}
 
-  // Home Assistant: Outdoor PM2.5
-  else if (strcmp(topic, HASS_OUT_PM25) == 0)
-  {
-    showMessage(topic, payloadAsChars);
-    wOutdoorPM25.updateText(payloadAsChars, floatStrLen);
-  }
+// Home Assistant: Outdoor PM2.5
+static void handleOutdoorPM25(char *payload)
+{
+  wOutdoorPM25.updateText(payload, floatStrLen);
+}
 
-  // Home Assistant: Living room temperature
-  else if (strcmp(topic, HASS_LR_TEMP) == 0)
-  {
-    showMessage(topic, payloadAsChars);
-    wHouseTemp.updateText(payloadAsChars, tempC2FHelper);
-  }
+// Home Assistant: Living room temperature
+static void handleHouseTemp(char *payload)
+{
+  wHouseTemp.updateText(payload, tempC2FHelper);
+}
+
+// Home Assistant: Living room dewpoint
+static void handleHouseDewpoint(char *payload)
+{
+  wHouseDewpoint.updateText(payload, tempC2FHelper);
+}
+
+// RPi Weather Station: Wind
+static void handleWind(char *payload)
+{
+  wOutdoorWind.updateText(payload, floatStrLen);
+}
+
+// RPi Weather Station: Rainfall
+static void handleRainfall(char *payload)
+{
+  wOutdoorRainGauge.updateText(payload, floatStrLen);
+}
+
+// Home Assistant: Living room VOC index
+static void handleHouseVOC(char *payload)
+{
+  wHouseVOC.updateText(payload, floatStrLen);
+}
+
+// Home Assistant: Garage door (open/closed/opening/closing)
+static void handleGarageDoor(char *payload)
+{
+  char text[WIDGET_TEXT_LEN+1];
+  snprintf(text, sizeof(text), "Garage %s", payload);
+  wGarageDoor.updateText(text);
+}
+
+// Home Assistant: Chores/reminders due, one per line, each
+// optionally with a tab and the seconds to show it for
+static void handleChores(char *payload)
+{
+  wChores.updateText(payload);
+}
+
+// Weather: Alerts
+static void handleWeatherAlert(char *payload)
+{
+  wWeatherAlerts.updateText(payload);
+}
+
+// Weather: Current conditions/state
+static void handleWeatherState(char *payload)
+{
+  wOutdoorWeather.updateWeather(payload, daytime);
+}
+
+// Weather: Dewpoint from the weather entity, in its own units
+static void handleWeatherDewpoint(char *payload)
+{
+  wOutdoorDewpoint.updateText(payload, tempDegreeHelper);
+}
+
+// Weather: State and attributes of the weather entity as JSON, eg.
+// {"state": "rainy", "attributes": {"temperature": 54, ...}}
+static const JsonBinding weatherBindings[] = {
+  {"state",                   handleWeatherState},
+  {"attributes.temperature",  handleOutdoorTemp},
+  {"attributes.dew_point",    handleWeatherDewpoint},
+  {"attributes.wind_speed",   handleWind},
+};
+
+// Weather: Condition/state forecast
+//
+// TODO: Need to decouple recording of forecast data internally
+// and rendering to screen; eg: an update of forecast topic should
+// not automatically trigger display and rendering of it.  We need
+// a timer to show this at some interval, rather then whenever
+// new MQTT data is posted to the relevant topics, though this
+// is done at regular intervals itself.
+//
+static void handleForecastState(char *payload)
+{
+  wOutdoorForecast.updateWeather(payload, daytime);
+}
 
-  // Home Assistant: Living room dewpoint
-  else if (strcmp(topic, HASS_LR_DEW) == 0)
+// Weather: Temperature forecast
+// TODO: See above note for forecast, applies here as well
+static void handleForecastTemp(char *payload)
+{
+  // Limit the number of characters rendered
+  char temp[7];
+  memset(temp, ' ', 6);
+  strncpy(temp, payload, 6);
+  temp[6] = '\0';
+
+  // The forecast is stacked above the current weather, so
+  // showing/hiding it only recomposites the cached surfaces
+  wOutdoorForecast.setResetActiveTime(milliseconds(refreshActiveDelay));
+  wOutdoorForecast.updateText(temp);
+  wOutdoorForecast.setActive(true);
+
+  wOutdoorWeather.setActive(false);
+  wOutdoorWeather.setResetActiveTime(milliseconds(refreshActiveDelay));
+}
+
+// Set the text color of widgets on every page
+static void setTextColor(Color color)
+{
+  colorText = color;
+  for (uint8_t p = 0; p < pageManager.size(); p++)
   {
-    showMessage(topic, payloadAsChars);
-    wHouseDewpoint.updateText(payloadAsChars, tempC2FHelper);
+    WidgetManager *manager = pageManager[p]->widgets;
+    for (int i=0; i<manager->size(); i++) {
+      (*manager)[i]->setTextColor(color);
+    }
   }
+}
 
-  // RPi Weather Station: Wind
-  else if (strcmp(topic, PIWEATHER_MAX_WIND) == 0)
+// "Weather": Sun position
+static void handleSun(char *payload)
+{
+  if (strcmp(payload, "above_horizon") == 0)
   {
-    showMessage(topic, payloadAsChars);
-    wOutdoorWind.updateText(payloadAsChars, floatStrLen);
-  }
+    daytime = true;
+    setTextColor(colorTextDay);
 
-  // RPi Weather Station: Rainfall
-  else if (strcmp(topic, PIWEATHER_RAINFALL) == 0)
+    setBrightness(50);
+    forceRefresh = true;
+  }
+  else if (strcmp(payload, "below_horizon") == 0)
   {
-    showMessage(topic, payloadAsChars);
-    wOutdoorRainGauge.updateText(payloadAsChars, floatStrLen);
+    daytime = false;
+    setTextColor(colorTextNight);
+
+    setBrightness(25);
+    forceRefresh = true;
   }
+  else
+    _error("unknown sun state received, skipping update");
 
-  // Weather: Alerts
-  else if (strcmp(topic, WEATHER_ALERT) == 0)
-  {
-    showMessage(topic, payloadAsChars);
-    wWeatherAlerts.updateText(payloadAsChars);
+  // Don't update icon for now, as we don't have night icons currently
+  // wOutdoorWeather.updateIcon(NULL, weatherIconHelper);
+}
+
+// Home Assistant: HVAC state
+static void handleThermostat(char *payload)
+{
+  if (strcmp(payload, "heating") == 0)
+    wHouseTemp.setIconImage(7, 7, big_house_heating);
+  else if (strcmp(payload, "cooling") == 0)
+    wHouseTemp.setIconImage(7, 7, big_house_cooling);
+  else if (strcmp(payload, "idle (heat)") == 0)
+    wHouseTemp.setIconImage(7, 7, big_house_mode_heat);
+  else if (strcmp(payload, "idle (cool)") == 0)
+    wHouseTemp.setIconImage(7, 7, big_house_mode_cool);
+  else if (strcmp(payload, "fan_running") == 0)
+    wHouseTemp.setIconImage(7, 7, big_house_fan);
+  else if (strcmp(payload, "off") == 0)
+    wHouseTemp.setIconImage(7, 7, big_house);
+
+  wHouseTemp.markDirty();
+}
+
+// Home Assistant: Calendar events, one per line, each
+// optionally with a tab and the seconds to show it for
+static void handleCalendar(char *payload)
+{
+  wCalendar.updateText(payload);
+}
+
+// Sign: Change brightness
+static void handleBrightness(char *payload)
+{
+  brightness = atoi(payload);
+  if (brightness > 100)
+    brightness = 100;
+  setBrightness(brightness);
+  forceRefresh = true;
+}
+
+static void handleDebugWidget(char *payload)
+{
+}
+
+// Debug: Scroll speed (ms per pixel) of long text
+static void handleScrollDelay(char *payload)
+{
+  milliseconds period(atoi(payload));
+  wCalendar.setScrollPeriod(period);
+  wWeatherAlerts.setScrollPeriod(period);
+  wChores.setScrollPeriod(period);
+}
+
+// Debug: Enable/disable tracing, or dump the trace (written
+// by the main loop, rather than during a frame)
+static void handleTrace(char *payload)
+{
+  if (strcmp(payload, "on") == 0)
+    setTraceEnabled(true);
+  else if (strcmp(payload, "off") == 0)
+    setTraceEnabled(false);
+  else if (strcmp(payload, "dump") == 0)
+    requestTraceDump();
+}
+
+// Debug: Record received messages for replay, to our default
+// capture file ("on") or one named in CAPTURE_DIR, until "off"
+static void handleCapture(char *payload)
+{
+  if (strcmp(payload, "on") == 0)
+    startCapture();
+  else if (strcmp(payload, "off") == 0)
+    stopCapture();
+  else
+    startCapture(payload);
+}
+
+// Debug: Enable/disable scrolling of long text
+static void handleScrollState(char *payload)
+{
+  bool scroll = (strcmp(payload, "on") == 0);
+  wCalendar.setScrollText(scroll);
+  wWeatherAlerts.setScrollText(scroll);
+  wChores.setScrollText(scroll);
+  wCalendar.markDirty();
+  wWeatherAlerts.markDirty();
+  wChores.markDirty();
+}
+
+// Debug: Show a page by name, or enable/disable page
+// rotation ("rotate on/off") or slide transitions
+static void handlePage(char *payload)
+{
+  if (strcmp(payload, "rotate on") == 0)
+    pageManager.setRotation(true);
+  else if (strcmp(payload, "rotate off") == 0)
+    pageManager.setRotation(false);
+  else if (strcmp(payload, "slide on") == 0)
+    pageManager.setSlide(true);
+  else if (strcmp(payload, "slide off") == 0)
+    pageManager.setSlide(false);
+  else
+    pageManager.showPage(payload);
+}
+
+// Topics we subscribe to and their handlers.  Each subscription is
+// made with its index (plus one) as the subscription identifier,
+// which the broker returns with every message on it.  Topics with
+// infrequent updates we don't want to miss use QoS 1, so they are
+// queued in our session while we're disconnected.
+const TopicHandler topicHandlers[] = {
+  {HASS_OUT_TEMP,       0, handleOutdoorTemp},
+  {HASS_OUT_DEW,        0, handleOutdoorDewpoint},
+  {HASS_OUT_PM25,       0, handleOutdoorPM25},
+  {HASS_LR_TEMP,        0, handleHouseTemp},
+  {HASS_LR_DEW,         0, handleHouseDewpoint},
+  {HASS_LR_VOC,         0, handleHouseVOC},
+  {HASS_GARAGE,         1, handleGarageDoor},
+  {HASS_CHORES,         1, handleChores},
+  {PIWEATHER_MAX_WIND,  0, handleWind},
+  {PIWEATHER_RAINFALL,  0, handleRainfall},
+  {WEATHER_ALERT,       1, handleWeatherAlert},
+  {WEATHER_NOW_STATE,   1, handleWeatherState},
+  {WEATHER_ATTRIBUTES,  1, NULL, weatherBindings,
+    sizeof(weatherBindings) / sizeof(JsonBinding)},
+  {WEATHER_FC_STATE,    1, handleForecastState},
+  {WEATHER_FC_TEMP,     1, handleForecastTemp},
+  {WEATHER_SUN,         1, handleSun},
+  {THERMOSTAT_STATE,    1, handleThermostat},
+  {CALENDAR_EVENT,      1, handleCalendar},
+  {SIGN_BRIGHTNESS,     1, handleBrightness},
+  {DEBUG_WIDGET,        0, handleDebugWidget},
+  {DEBUG_SCROLL_DELAY,  0, handleScrollDelay},
+  {DEBUG_TRACE,         0, handleTrace},
+  {DEBUG_SCROLL_STATE,  0, handleScrollState},
+  {DEBUG_CAPTURE,       0, handleCapture},
+  {DEBUG_PAGE,          0, handlePage},
+};
+const uint8_t numTopicHandlers = sizeof(topicHandlers) / sizeof(TopicHandler);
+
+// Find the handler for a message, from its subscription identifier
+// if we have one, or else by comparing the topic
+static const TopicHandler* findTopicHandler(const char *topic, uint32_t subscriptionId)
+{
+  if (subscriptionId > 0 && subscriptionId <= numTopicHandlers)
+    return &topicHandlers[subscriptionId - 1];
+
+  for (uint8_t i = 0; i < numTopicHandlers; i++) {
+    if (strcmp(topic, topicHandlers[i].topic) == 0)
+      return &topicHandlers[i];
   }
+  return NULL;
+}
 
-  // Weather: Current conditions/state
-  else if (strcmp(topic, WEATHER_NOW_STATE) == 0)
+// Store slots of each topic's value, and of each value bound
+// in JSON topics (after those of the topics), with the handler
+// of the value.  Built when the dashboard is set up.
+static uint8_t bindingSlots[STORE_MAX_SLOTS];
+static void (*slotHandlers[STORE_MAX_SLOTS])(char *);
+static uint8_t numSlots = 0;
+
+// Generation of the store, and of each slot, last
+// applied to our widgets by the render thread
+static uint32_t appliedGeneration = 0;
+static uint32_t appliedSlots[STORE_MAX_SLOTS];
+
+static void setupSlots()
+{
+  numSlots = numTopicHandlers;
+  for (uint8_t i = 0; i < numTopicHandlers; i++)
   {
-    showMessage(topic, payloadAsChars);
-    wOutdoorWeather.updateWeather(payloadAsChars, daytime);
+    slotHandlers[i] = topicHandlers[i].handler;
+    bindingSlots[i] = numSlots;
+    for (uint8_t j = 0; j < topicHandlers[i].numBindings && numSlots < STORE_MAX_SLOTS; j++)
+      slotHandlers[numSlots++] = topicHandlers[i].bindings[j].handler;
   }
+}
 
-  // Weather: Condition/state forecast
-  //
-  // TODO: Need to decouple recording of forecast data internally
-  // and rendering to screen; eg: an update of forecast topic should
-  // not automatically trigger display and rendering of it.  We need
-  // a timer to show this at some interval, rather then whenever
-  // new MQTT data is posted to the relevant topics, though this
-  // is done at regular intervals itself.
-  //
-  else if (strcmp(topic, WEATHER_FC_STATE) == 0)
-  {
-    showMessage(topic, payloadAsChars);
-    wOutdoorForecast.updateWeather(payloadAsChars, daytime);
+// Store the values from a JSON message bound to handlers,
+// finding them all in a single pass over the message
+static void storeJson(char *payload, const TopicHandler *handler)
+{
+  const char *paths[JSON_MAX_PATHS] = {};
+  JsonValue values[JSON_MAX_PATHS];
+  char text[STORE_VALUE_LEN + 1];
+  uint8_t base = bindingSlots[handler - topicHandlers];
+  uint8_t count = std::min<uint8_t>(handler->numBindings, JSON_MAX_PATHS);
+
+  for (uint8_t i = 0; i < count; i++)
+    paths[i] = handler->bindings[i].path;
+
+  if (jsonExtract(payload, strlen(payload), paths, values, count) == 0) {
+    _warn("no bound values found in JSON message, skipping update");
+    return;
   }
 
-  // Weather: Temperature forecast
-  // TODO: See above note for forecast, applies here as well
-  else if (strcmp(topic, WEATHER_FC_TEMP) == 0)
+  for (uint8_t i = 0; i < count; i++)
   {
-    showMessage(topic, payloadAsChars);
-
-    // Limit the number of characters rendered
-    char temp[7];
-    memset(temp, ' ', 6);
-    strncpy(temp, payloadAsChars, 6);
-    temp[6] = '\0';
-
-    // Note: Currently when rendering an inactive widget nothing is done
-    // (eg: clearing not performed).  This allows us to avoid race
-    // conditions here, where outdoorWeather is set back to active
-    // before outdoorForecast is deactivated (and thus cleared,
-    // resulting in a blank widget)
-    wOutdoorForecast.setResetActiveTime(milliseconds(refreshActiveDelay));
-    wOutdoorForecast.updateText(temp);
-    wOutdoorForecast.setActive(true);
-    wOutdoorForecast.render();
-  
-    wOutdoorWeather.setActive(false);
-    wOutdoorWeather.setResetActiveTime(milliseconds(refreshActiveDelay));
+    if (values[i].type == JSON_NONE || values[i].type == JSON_NULL)
+      continue;
+    jsonValueText(values[i], text, sizeof(text));
+    stateStore.publish(base + i, text, strlen(text), messageTime);
   }
+}
 
-  // "Weather": Sun position
-  else if (strcmp(topic, WEATHER_SUN) == 0)
-  {
-    showMessage(topic, payloadAsChars);
-    if (strcmp(payloadAsChars, "above_horizon") == 0)
-    {
-      daytime = true;
-      colorText = colorTextDay;
-      for (int i=0; i<widgets.size(); i++) {
-        widgets[i]->setTextColor(colorTextDay);
-      }
-
-      setBrightness(50);
-      displayDashboard(true);
-    }
-    else if (strcmp(payloadAsChars, "below_horizon") == 0)
-    {
-      daytime = false;
-      colorText = colorTextNight;
-      for (int i=0; i<widgets.size(); i++) {
-        widgets[i]->setTextColor(colorTextNight);
-      }
-
-      setBrightness(25);
-      displayDashboard(true);
-    }
-    else
-      _error("unknown sun state received, skipping update");
+// Parse a message into the state store, our panels'
+// render threads pick up the new values from there
+static void dispatchMessage(const struct mosquitto_message *msg, uint32_t subscriptionId)
+{
+  char *topic, *payload;
+  int length;
 
-    // Don't update icon for now, as we don't have night icons currently
-    // wOutdoorWeather.updateIcon(NULL, weatherIconHelper);
-  }
+  TRACE_SPAN("mqttOnMessage");
+  topic = msg->topic;
+  length = msg->payloadlen;
+  payload = (char *)msg->payload;
+  mqtt.messages++;
 
-  // Home Assistant: HVAC state
-  else if (strcmp(topic, THERMOSTAT_STATE) == 0)
-  {
-    showMessage(topic, payloadAsChars);
-    if (strcmp(payloadAsChars, "heating") == 0)
-      wHouseTemp.setIconImage(7, 7, big_house_heating);
-    else if (strcmp(payloadAsChars, "cooling") == 0)
-      wHouseTemp.setIconImage(7, 7, big_house_cooling);
-    else if (strcmp(payloadAsChars, "idle (heat)") == 0)
-      wHouseTemp.setIconImage(7, 7, big_house_mode_heat);
-    else if (strcmp(payloadAsChars, "idle (cool)") == 0)
-      wHouseTemp.setIconImage(7, 7, big_house_mode_cool);
-    else if (strcmp(payloadAsChars, "fan_running") == 0)
-      wHouseTemp.setIconImage(7, 7, big_house_fan);
-    else if (strcmp(payloadAsChars, "off") == 0)
-      wHouseTemp.setIconImage(7, 7, big_house);
-
-    displayDashboard();
-  }
+  char payloadAsChars[length + 1];
+  memcpy(payloadAsChars, payload, length);
+  payloadAsChars[length] = '\0';
 
-  // Home Assistant: Calendar event
-  else if (strcmp(topic, CALENDAR_EVENT) == 0)
-  {
-    showMessage(topic, payloadAsChars);
-    wCalendar.updateText(payloadAsChars);
-    displayDashboard();
+  // Save for restoring at startup, and record for replay
+  recordState(topic, payloadAsChars, length);
+  captureMessage(topic, payloadAsChars, length);
+
+  const TopicHandler *handler = findTopicHandler(topic, subscriptionId);
+  if (handler == NULL) {
+    _debug("no handler for topic %s, ignoring", topic);
+    return;
   }
 
-  // Sign: Change brightness
-  else if (strcmp(topic, SIGN_BRIGHTNESS) == 0)
-  {
-    showMessage(topic, payloadAsChars);
-    brightness = atoi((char*)payload);
-    if (brightness > 100)
-      brightness = 100;
-    setBrightness(brightness);
-    displayDashboard(true);
+  showMessage(topic, payloadAsChars);
+  if (handler->bindings)
+    storeJson(payloadAsChars, handler);
+  else
+    stateStore.publish(handler - topicHandlers, payloadAsChars, length, messageTime);
+}
+
+// Pass values changed in the store since we last looked to
+// their handlers, in the order they were received.  Handlers
+// only update widget state and mark them dirty.
+static void applyStoreUpdates()
+{
+  uint32_t generation = stateStore.generation();
+  if (generation == appliedGeneration)
+    return;
+
+  std::pair<uint32_t, uint8_t> changed[STORE_MAX_SLOTS];
+  uint8_t numChanged = 0;
+  for (uint8_t slot = 0; slot < numSlots; slot++) {
+    uint32_t written = stateStore.slotGeneration(slot);
+    if (written != appliedSlots[slot])
+      changed[numChanged++] = {written, slot};
   }
+  std::sort(changed, changed + numChanged);
 
-  else if (strcmp(topic, DEBUG_WIDGET) == 0)
+  char text[STORE_VALUE_LEN + 1];
+  for (uint8_t i = 0; i < numChanged; i++)
   {
-    showMessage(topic, payloadAsChars);
+    uint8_t slot = changed[i].second;
+    appliedSlots[slot] = stateStore.read(slot, text, sizeof(text), &messageTime);
+    if (slotHandlers[slot])
+      slotHandlers[slot](text);
   }
-}
\ No newline at end of file
+  appliedGeneration = generation;
+}
+
+// Callback after message arriving on topic, also used
+// to replay messages without a subscription identifier
+void mqttOnMessage(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg)
+{
+  dispatchMessage(msg, 0);
+}
+
+// Callback after message arriving on topic, with MQTT v5 properties
+void mqttOnMessageV5(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg,
+  const mosquitto_property *props)
+{
+  uint32_t subscriptionId = 0;
+
+  mosquitto_property_read_varint(props, MQTT_PROP_SUBSCRIPTION_IDENTIFIER,
+    &subscriptionId, false);
+  dispatchMessage(msg, subscriptionId);
+}
@@ -2,10 +2,14 @@
 #include "display.h"
 #include "logger.h"
 #include "widget.h"
+#include "scheduler.h"
+#include "clock.h"
+#include "terminal.h"
 
 #include <canvas.h>
 #include <led-matrix.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <cstring>
 
@@ -36,20 +40,30 @@ Color colorAlert      = Color(248, 48, 8);
 
 rgb_matrix::RGBMatrix *matrix;
 rgb_matrix::PixelMapper *mapper;
+thread_local rgb_matrix::Canvas *canvas;
+static TerminalCanvas *terminal = NULL;
 
 
-extern int8_t clockOffset;
-extern uint8_t rowDayStart;
-extern uint8_t rowDateStart;
-extern uint8_t rowTimeStart;
-extern uint8_t clockWidth;
 
 extern GirderFont *defaultFont, *clockFont;
 
+static void loadFonts()
+{
+  _log("loading fonts");
+  defaultFont = new GirderFont();
+  defaultFont->LoadFontAsync(GirderFont::FONT_DEFAULT);
+  clockFont = new GirderFont();
+  clockFont->LoadFontAsync(GirderFont::FONT_CLOCK);
+}
+
 bool setupDisplay(uint8_t configNum)
 {
   RGBMatrix::Options displaySettings;
   rgb_matrix::RuntimeOptions runtimeSettings;
+  microseconds animBudget = ANIM_BUDGET_DEFAULT;
+
+  if (configNum == DISPLAY_CONFIG_TERMINAL)
+    return setupTerminalDisplay();
 
    _log("initializing display");
 
@@ -86,6 +100,7 @@ bool setupDisplay(uint8_t configNum)
     displaySettings.brightness = 50;
     displaySettings.led_rgb_sequence = "RBG";
     runtimeSettings.gpio_slowdown = 1;
+    animBudget = ANIM_BUDGET_PIZERO;
   }
   else {
     _error("unknown config: %d", configNum);
@@ -94,6 +109,7 @@ bool setupDisplay(uint8_t configNum)
 
   runtimeSettings.daemon = 0;
   runtimeSettings.drop_privileges = 1;
+  animScheduler.setFrameBudget(animBudget);
 
   // Initialize matrix
   matrix = RGBMatrix::CreateFromOptions(displaySettings, runtimeSettings);
@@ -106,24 +122,76 @@ bool setupDisplay(uint8_t configNum)
   // Clearing matrix
   matrix->Fill(0, 0, 0);
   matrix->SetBrightness(50);
+  canvas = matrix;
 
-  // Load fonts
-  _log("loading fonts");
-  defaultFont = new GirderFont(GirderFont::FONT_DEFAULT);
-  clockFont = new GirderFont(GirderFont::FONT_CLOCK);
+  loadFonts();
+  return true;
+}
+
+// Render into a canvas we don't own instead of the matrix,
+// eg. for replaying captured messages off the device
+bool setupOffscreenDisplay(rgb_matrix::Canvas *target)
+{
+  _log("initializing offscreen display (%dx%d)", target->width(), target->height());
+
+  matrix = NULL;
+  canvas = target;
+  canvas->Fill(0, 0, 0);
+
+  loadFonts();
+  return true;
+}
+
+// Draw to the terminal instead of the matrix, to preview
+// layouts off the device.  Logging to the console would
+// garble the display, so it goes to the log file only
+// (see girderlog).
+bool setupTerminalDisplay()
+{
+  _log("initializing terminal display (%dx%d)", DISPLAY_WIDTH, DISPLAY_HEIGHT);
+  if (!isatty(STDOUT_FILENO)) {
+    _error("terminal display needs a terminal on stdout");
+    return false;
+  }
+
+  matrix = NULL;
+  terminal = new TerminalCanvas(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+  canvas = terminal;
+  setConsoleLogging(false);
 
+  loadFonts();
   return true;
 }
 
+// Show a finished frame, for displays that aren't drawn
+// to directly
+void presentDisplay()
+{
+  if (terminal)
+    terminal->flush();
+}
+
 void shutdownDisplay()
 {
+  if (terminal) {
+    terminal->close();
+    delete terminal;
+    terminal = NULL;
+    setConsoleLogging(true);
+  }
+
+  if (matrix == NULL)
+    return;
+
   matrix->Clear();
   delete matrix;
+  matrix = NULL;
 }
 
 void setBrightness(uint8_t brightness)
 {
-  matrix->SetBrightness(brightness);
+  if (matrix)
+    matrix->SetBrightness(brightness);
 }
 
 
@@ -152,69 +220,36 @@ Color hexColorBright2RGB(uint16_t hexValue, int br)
 } */
 
 // Draw a filled rectangle at (x,y) with width, height and color
+// If no target is given we draw directly to the frame canvas
 void drawRect(uint16_t x_start, uint16_t y_start,
-  uint16_t width, uint16_t height, Color color)
+  uint16_t width, uint16_t height, Color color, Canvas *target)
 {
+  if (target == NULL)
+    target = canvas;
+
   // _debug("drawRect x,y,w,h: %d,%d,%d,%d", x_start, y_start, width, height);
   for (uint16_t x = x_start; x < x_start + width; x++) {
     for (uint16_t y = y_start; y < y_start + height; y++) {
-      matrix->SetPixel(x, y, color.r, color.g, color.b);
+      target->SetPixel(x, y, color.r, color.g, color.b);
     }
   }
 }
 
 // Draw an image of width, height at (x,y)
-void drawIcon(int x, int y, int width, int height, const uint8_t *image)
+void drawIcon(int x, int y, int width, int height,
+  const uint8_t *image, Canvas *target)
 {
-  SetImage(matrix, x, y, image, width * height * 3, width,
+  if (target == NULL)
+    target = canvas;
+
+  SetImage(target, x, y, image, width * height * 3, width,
       height, false);
 }
 
 // Show the day of week, date and time
 void displayClock(bool force)
 {
-  char buffer[6];
-  static uint8_t lMinute = 0;
-
-  time_t local = time(0);
-  tm *localtm = localtime(&local);
-
-  //
-  // Skip if no change and not forced
-  //
-  // This assumes/relies that every clock field update
-  // will include a change in the "minute", which is
-  // correct unless we include seconds in the clock
-  //
-  if (minute(localtm) == lMinute && !force) {
-    return;
-  }
-  else {
-    lMinute = minute(localtm);
-  }
-
-  // Clear the widget
-  uint8_t clockX = clockOffset;
-  uint8_t dateFontWidth = FONT_CLOCK_WIDTH;
-  uint8_t renderLen;
-  int8_t offset;
-  drawRect(clockX, 0, clockWidth, 32, colorBlack);
-
-  // Render the day of week
-  offset = (clockWidth - (strlen(s_weekday(localtm)) * dateFontWidth)) / 2;
-  drawText(clockX + offset, rowDayStart, colorDate, s_weekday(localtm), clockFont);
-
-  // Render the date
-  snprintf(buffer, 6, "%d/%d", month(localtm), day(localtm));
-  renderLen = textRenderLength(buffer, clockFont);
-  offset = (clockWidth / 2) - (renderLen / 2);
-  drawText(clockX + offset, rowDateStart, colorDate, buffer, clockFont, true);
-
-  // Render the time
-  snprintf(buffer, 6, "%d:%02d", hour(localtm), minute(localtm));
-  renderLen = textRenderLength(buffer, clockFont);
-  offset = (clockWidth / 2) - (renderLen / 2);
-  drawText(clockX + offset, rowTimeStart, colorTime, buffer, clockFont, true);
+  clockRenderer.render(force);
 }
 
 // Debugging routine to draw some rainbow stripes
@@ -2,63 +2,154 @@
 #include "dynamicwidget.h"
 #include "datetime.h"
 #include "logger.h"
+#include "icons.h"
 
 #include <time.h>
 #include <string.h>
 
+#include <algorithm>
+
 
 void MultilineWidget::setTextUpdatePeriod(milliseconds period) {
   textUpdatePeriod = period;
 }
 
+milliseconds MultilineWidget::dwellTime(uint8_t line)
+{
+  if (lineDwell[line] > 0ms)
+    return lineDwell[line];
+  return textUpdatePeriod;
+}
+
 void MultilineWidget::checkUpdate() {
   checkTextUpdate();
+  checkScrollUpdate();
+}
+
+// While a scroll pass holds back our rotation, only
+// the scrolling needs us, so wait for its next step
+milliseconds MultilineWidget::nextUpdateIn()
+{
+  if (numLines < 2 || scrollPending())
+    return DashboardWidget::nextUpdateIn();
+
+  auto wait = std::chrono::duration_cast<milliseconds>(
+      lastUpdateTime + dwellTime(currentTextLine) - system_clock::now());
+  return std::clamp(wait, 0ms, DashboardWidget::nextUpdateIn());
 }
 
+// Rotate to the next line, but let scrolling
+// text finish at least one pass before we do
 void MultilineWidget::checkTextUpdate()
 {
   // _debug("checkTextUpdate @ %ld: last update=%ld", clock_ts(), lastUpdateTime);
-  if (system_clock::now() >= lastUpdateTime + textUpdatePeriod) {
-    currentTextLine = 1 - currentTextLine;
+  if (numLines < 2)
+    return;
+
+  if (system_clock::now() >= lastUpdateTime + dwellTime(currentTextLine) &&
+      !scrollPending()) {
+    currentTextLine = (currentTextLine + 1) % numLines;
     doTextUpdate();
     lastUpdateTime = system_clock::now();
   }
 }
 
-// Update will rotate through the lines of text
-// (newline-delimited) stored in fullTextData
-void MultilineWidget::doTextUpdate()
+// Catch up on any rotations missed while hidden,
+// by skipping directly to the current line
+void MultilineWidget::setVisible(bool value)
 {
-  char *token, *str, *strFree;
-  int i = 0;
+  DashboardWidget::setVisible(value);
+  if (!value || numLines < 2)
+    return;
 
-  // Abort if no text is set
-  if (strcmp(fullTextData, "") == 0)
+  auto now = system_clock::now();
+  auto elapsed = now - lastUpdateTime;
+  if (elapsed < dwellTime(currentTextLine))
     return;
 
-  // Parse our text data, searching for newlines and track count
-  // When we find desired line, copy contents to our widget text
-  strFree = str = strdup(fullTextData);
-  while ((token = strsep(&str, "\n"))) {
-    if (i++ == currentTextLine) {
-      // _debug("dWidget: %s: updating text to %s", name, token);
-      strncpy(tData, token, WIDGET_TEXT_LEN);
-      break;
-    }
+  // Skip any full rotations, then step through the remainder
+  milliseconds cycle = 0ms;
+  for (auto i = 0; i < numLines; i++)
+    cycle += dwellTime(i);
+  elapsed %= cycle;
+
+  while (elapsed >= dwellTime(currentTextLine)) {
+    elapsed -= dwellTime(currentTextLine);
+    currentTextLine = (currentTextLine + 1) % numLines;
   }
 
-  free(strFree);
+  doTextUpdate();
+  lastUpdateTime = now - std::chrono::duration_cast<milliseconds>(elapsed);
+}
+
+// Copy the current line of text (newline-delimited)
+// stored in fullTextData to our widget text
+void MultilineWidget::loadTextLine()
+{
+  memcpy(tData, fullTextData + lineStart[currentTextLine],
+      lineLength[currentTextLine]);
+  tData[lineLength[currentTextLine]] = '\0';
+  tScrollReset = true;
+}
+
+// Update will show the current line of text
+void MultilineWidget::doTextUpdate()
+{
+  // Abort if no text is set
+  if (numLines == 0)
+    return;
+
+  loadTextLine();
   render();
 }
 
-// Set widget text
+// Set widget text, indexing the start and length of each
+// line for rotation.  Empty lines (eg. a trailing newline)
+// are skipped.  A line may end with a tab and the number of
+// seconds to show it for, eg. "Dentist 3pm\t15".
 void MultilineWidget::setText(char *text)
 {
   // _debug("dWidget %s: setting text to: %s", name, text);
   strncpy(fullTextData, text, WIDGET_TEXT_LEN);
+  fullTextData[WIDGET_TEXT_LEN] = '\0';
+
+  numLines = 0;
+  uint16_t start = 0;
+  for (uint16_t i = 0; ; i++)
+  {
+    if (fullTextData[i] != '\n' && fullTextData[i] != '\0')
+      continue;
+
+    char *dwell = (char *) memchr(fullTextData + start, '\t', i - start);
+    uint16_t length = (dwell ? dwell - fullTextData : i) - start;
+
+    if (length > 0 && numLines == MULTILINE_MAX_LINES) {
+      _warn("widget %s: text exceeds %d lines, truncating",
+          name, MULTILINE_MAX_LINES);
+      break;
+    }
+    if (length > 0) {
+      lineStart[numLines] = start;
+      lineLength[numLines] = length;
+      lineDwell[numLines++] = std::chrono::seconds(dwell ? atoi(dwell + 1) : 0);
+    }
+    start = i + 1;
+
+    if (fullTextData[i] == '\0')
+      break;
+  }
+
+  // No text is shown as a single empty line
+  if (numLines == 0) {
+    lineStart[0] = lineLength[0] = 0;
+    lineDwell[numLines++] = 0ms;
+  }
+
   // Should we reset widget back to the first line when updating?
+  // Rendering is done by our caller, updateText()
   currentTextLine = 0;
-  doTextUpdate();
+  lastUpdateTime = system_clock::now();
+  loadTextLine();
 }
 
 /*** AnimatedWidget ***/
@@ -69,6 +160,14 @@ void AnimatedWidget::setImageUpdatePeriod(milliseconds period) {
 
 void AnimatedWidget::checkUpdate() {
   checkImageUpdate();
+  checkScrollUpdate();
+}
+
+milliseconds AnimatedWidget::nextUpdateIn()
+{
+  auto wait = std::chrono::duration_cast<milliseconds>(
+      lastImageTime + imageUpdatePeriod - system_clock::now());
+  return std::clamp(wait, 0ms, DashboardWidget::nextUpdateIn());
 }
 
 void AnimatedWidget::checkImageUpdate()
@@ -80,4 +179,93 @@ void AnimatedWidget::checkImageUpdate()
   }
 }
 
-void AnimatedWidget::doImageUpdate() {}
\ No newline at end of file
+// Resume animating when visible again, missed
+// frames are dropped rather than replayed
+void AnimatedWidget::setVisible(bool value)
+{
+  DashboardWidget::setVisible(value);
+  if (value)
+    lastImageTime = system_clock::now() - imageUpdatePeriod;
+}
+
+void AnimatedWidget::doImageUpdate() {}
+
+/*** TrendWidget ***/
+
+// Arrow icons, converted once for all trend widgets
+static uint8_t trendImages[3][5 * 7 * 3];
+static bool trendImagesInit = false;
+
+static void initTrendImages()
+{
+  const uint16_t *icons[3] = {down_icon, NULL, up_icon};
+  for (int i = 0; i < 3; i++) {
+    for (int p = 0; icons[i] && p < 5 * 7; p++)
+      color565_2RGB(icons[i][p], &trendImages[i][3 * p]);
+  }
+  trendImagesInit = true;
+}
+
+// Follow a sensor's history, showing an arrow once its value
+// changes by at least threshold over the window
+void TrendWidget::setSource(SensorHistory *history, float minChange,
+    std::chrono::seconds trendWindow)
+{
+  if (!trendImagesInit)
+    initTrendImages();
+
+  source = history;
+  threshold = minChange;
+  window = trendWindow;
+  seenVersion = 0;
+  setIconImage(5, 7, trendImages[1]);
+}
+
+// Show the lowest and highest values over a window as our text
+void TrendWidget::setRange(std::chrono::seconds value) {
+  rangeWindow = value;
+}
+
+void TrendWidget::checkUpdate()
+{
+  if (source && source->version() != seenVersion)
+    doTrendUpdate();
+  checkScrollUpdate();
+}
+
+void TrendWidget::doTrendUpdate()
+{
+  seenVersion = source->version();
+
+  int8_t value = source->trend(threshold, window);
+  if (value != trend) {
+    trend = value;
+    iImage = trendImages[trend + 1];
+    markDirty();
+  }
+
+  // Our data is as old as the sensor's
+  HistorySample last;
+  if (source->latest(&last))
+    dataTime = system_clock::from_time_t(last.time);
+  checkStale();
+
+  float min, max;
+  if (rangeWindow > 0s && source->range(rangeWindow, &min, &max))
+  {
+    char text[WIDGET_TEXT_LEN+1];
+    snprintf(text, sizeof(text), "%.0f-%.0f", min, max);
+    if (strncmp(text, tData, WIDGET_TEXT_LEN) != 0) {
+      setText(text);
+      markDirty();
+    }
+  }
+}
+
+// Without a range, we only show the arrow
+int TrendWidget::renderText()
+{
+  if (!tInit)
+    return 0;
+  return DashboardWidget::renderText();
+}
@@ -4,12 +4,18 @@
 
 #include "font.h"
 #include "logger.h"
+#include "startup.h"
+
+#include <vector>
 
 using rgb_matrix::DrawText;
 
 GirderFont *defaultFont, *clockFont;
 
-extern rgb_matrix::RGBMatrix *matrix;
+extern thread_local rgb_matrix::Canvas *canvas;
+
+static std::vector<std::shared_future<void>> fontLoads;
+static const char *fontPhases[] = {"default font", "large font", "small font", "clock font"};
 
 
 // Load our fonts
@@ -45,6 +51,21 @@ void GirderFont::LoadFont(fonts newFont)
   }
 }
 
+// Parse a font on the task pool, in parallel with other startup work
+void GirderFont::LoadFontAsync(fonts newFont)
+{
+  const char *phase = (newFont <= FONT_CLOCK) ? fontPhases[newFont] : "font";
+  fontLoads.push_back(startupTask(phase, [this, newFont]() { LoadFont(newFont); }));
+}
+
+// Wait for fonts loading in the background
+void waitForFonts()
+{
+  for (auto &load : fontLoads)
+    load.wait();
+  fontLoads.clear();
+}
+
 // TODO: Store the information as data in files or defines, etc
 
 // Non full-width glyphs are not left-justified, so
@@ -92,7 +113,7 @@ int8_t vGlyphOffset(const char glyph, GirderFont *font)
 
 // Calculate the width of a glyph, with the spacing between them
 uint8_t vGlyphWidth(const char glyph, GirderFont *font,
-                    bool calcOnly = false)
+                    bool calcOnly)
 {
   // The approach here is to set the width to the full font
   // width by default, and adjust (shrink) the width with an
@@ -156,9 +177,10 @@ uint8_t vGlyphWidth(const char glyph, GirderFont *font,
   return font->width + wOffset;
 }
 
-// Render a variable-width glyph to the matrix
+// Render a variable-width glyph to a canvas
 void renderGlyph(const char glyph, uint8_t x, uint8_t y,
-                 GirderFont *font, Color color)
+                 GirderFont *font, Color color,
+                 rgb_matrix::Canvas *target)
 {
   char buffer[2] = {glyph, '\0'};
 
@@ -166,64 +188,64 @@ void renderGlyph(const char glyph, uint8_t x, uint8_t y,
   if (strcmp(font->name, FONT_DEFAULT_NAME) == 0)
   {
     if (glyph == '.') {
-      matrix->SetPixel(x, y - 1, color.r, color.g, color.b);
+      target->SetPixel(x, y - 1, color.r, color.g, color.b);
       return;
     }
     else if (glyph == ':')
     {
-      matrix->SetPixel(x + 1, y - 2, color.r, color.g, color.b);
-      matrix->SetPixel(x + 1, y - 3, color.r, color.g, color.b);
-      matrix->SetPixel(x + 1, y - 5, color.r, color.g, color.b);
-      matrix->SetPixel(x + 1, y - 6, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 2, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 3, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 5, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 6, color.r, color.g, color.b);
       return;
     }
     else if (glyph == '/')
     {
-      matrix->SetPixel(x + 1, y - 1, color.r, color.g, color.b);
-      matrix->SetPixel(x + 1, y - 2, color.r, color.g, color.b);
-      matrix->SetPixel(x + 2, y - 3, color.r, color.g, color.b);
-      matrix->SetPixel(x + 2, y - 4, color.r, color.g, color.b);
-      matrix->SetPixel(x + 2, y - 5, color.r, color.g, color.b);
-      matrix->SetPixel(x + 3, y - 6, color.r, color.g, color.b);
-      matrix->SetPixel(x + 3, y - 7, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 1, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 2, color.r, color.g, color.b);
+      target->SetPixel(x + 2, y - 3, color.r, color.g, color.b);
+      target->SetPixel(x + 2, y - 4, color.r, color.g, color.b);
+      target->SetPixel(x + 2, y - 5, color.r, color.g, color.b);
+      target->SetPixel(x + 3, y - 6, color.r, color.g, color.b);
+      target->SetPixel(x + 3, y - 7, color.r, color.g, color.b);
       return;
     }
     else if (int(glyph) == 176)
     {
-      matrix->SetPixel(x, y - 6, color.r, color.g, color.b);
-      matrix->SetPixel(x, y - 7, color.r, color.g, color.b);
-      matrix->SetPixel(x + 1, y - 6, color.r, color.g, color.b);
-      matrix->SetPixel(x + 1, y - 7, color.r, color.g, color.b);
+      target->SetPixel(x, y - 6, color.r, color.g, color.b);
+      target->SetPixel(x, y - 7, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 6, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 7, color.r, color.g, color.b);
       return;
     }
   }
   else if (strcmp(font->name, FONT_SMALL_NAME) == 0)
   {
     if (glyph == '.') {
-      matrix->SetPixel(x, y - 1, color.r, color.g, color.b);
+      target->SetPixel(x, y - 1, color.r, color.g, color.b);
       return;
     }
     else if (glyph == ':')
     {
-      matrix->SetPixel(x + 1, y - 2, color.r, color.g, color.b);
-      matrix->SetPixel(x + 1, y - 3, color.r, color.g, color.b);
-      matrix->SetPixel(x + 1, y - 5, color.r, color.g, color.b);
-      matrix->SetPixel(x + 1, y - 6, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 2, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 3, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 5, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 6, color.r, color.g, color.b);
       return;
     }
     else if (glyph == '/') {
-      matrix->SetPixel(x + 1, y - 1, color.r, color.g, color.b);
-      matrix->SetPixel(x + 1, y - 2, color.r, color.g, color.b);
-      matrix->SetPixel(x + 2, y - 3, color.r, color.g, color.b);
-      matrix->SetPixel(x + 2, y - 4, color.r, color.g, color.b);
-      matrix->SetPixel(x + 3, y - 5, color.r, color.g, color.b);
-      matrix->SetPixel(x + 3, y - 6, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 1, color.r, color.g, color.b);
+      target->SetPixel(x + 1, y - 2, color.r, color.g, color.b);
+      target->SetPixel(x + 2, y - 3, color.r, color.g, color.b);
+      target->SetPixel(x + 2, y - 4, color.r, color.g, color.b);
+      target->SetPixel(x + 3, y - 5, color.r, color.g, color.b);
+      target->SetPixel(x + 3, y - 6, color.r, color.g, color.b);
       return;
     }
   }
 
   // Call upstream library to render, and adjust position
-  DrawText(matrix, *font->font, x - vGlyphOffset(glyph, font),
+  DrawText(target, *font->font, x - vGlyphOffset(glyph, font),
            y, color, NULL, buffer, font->kerning);
 }
 
@@ -232,31 +254,40 @@ uint16_t textRenderLength(const char *text, GirderFont *font)
 {
   uint16_t length = 0;
 
-  for (size_t i = 0; i < strlen(text); i++) {
-    length += vGlyphWidth(text[i], font, true);
+  for (const char *glyph = text; *glyph; glyph++) {
+    length += vGlyphWidth(*glyph, font, true);
   }
 
   // Remove trailing space
   return length - 1;
 }
 
-// Render text in color at (x,y)
-void drawText(uint8_t x, uint8_t y, Color color, const char *text,
-              GirderFont *font, bool vWidth, bool debug)
+// Render text in color at (x,y), returning the rendered
+// length (same as textRenderLength() for variable-width text)
+uint16_t drawText(uint8_t x, uint8_t y, Color color, const char *text,
+              GirderFont *font, bool vWidth, bool debug,
+              rgb_matrix::Canvas *target)
 {
+  uint16_t length = 0;
+
   if (font == NULL) {
     font = defaultFont;
   }
+  if (target == NULL) {
+    target = canvas;
+  }
   // _debug("drawText x,y,msg: %d,%d,\"%s\"", x, y, text);
 
   if (strchr(text, '.') != NULL && strlen(text) != 3) {
-    _warn("unable to autoparse text for custom rendering, using default");
+    _warnLimited(std::chrono::minutes(1),
+        "unable to autoparse text for custom rendering, using default");
   }
 
+  uint8_t textLen = strlen(text);
+
   if (vWidth)
   {
     uint16_t xStart = x;
-    uint8_t textLen = strlen(text);
     // uint16_t renderLen = textRenderLength(text, font);
     // _debug("vstring='%s' len=%d renderLen=%d", text, textLen, renderLen);
 
@@ -265,18 +296,19 @@ void drawText(uint8_t x, uint8_t y, Color color, const char *text,
     {
       glyph = *(text + idx);
       // _debug("glyph: '%c'", glyph);
-      renderGlyph(glyph, xStart, y + font->height, font, color);
+      renderGlyph(glyph, xStart, y + font->height, font, color, target);
       if (debug)
       {
         int8_t gOffset = vGlyphOffset(glyph, font);
-        matrix->SetPixel(xStart, y+font->height, 192, 0, 0);
+        target->SetPixel(xStart, y+font->height, 192, 0, 0);
         if (gOffset != 0) {
-          matrix->SetPixel(xStart + vGlyphOffset(glyph, font), y+font->height, 0, 192, 0);
+          target->SetPixel(xStart + vGlyphOffset(glyph, font), y+font->height, 0, 192, 0);
         }
       }
       xStart += vGlyphWidth(glyph, font);
+      length += vGlyphWidth(glyph, font, true);
       if (debug) {
-        matrix->SetPixel(xStart, y+font->height, 0, 0, 192);
+        target->SetPixel(xStart, y+font->height, 0, 0, 192);
         // _debug("new xStart: %d", xStart);
       }
     }
@@ -290,7 +322,14 @@ void drawText(uint8_t x, uint8_t y, Color color, const char *text,
     // is easily tweaking the vertical position/placement
     //
     // Using font.height() resulted in too large of gap
-    DrawText(matrix, *font->GetFont(), x, y + font->height,
+    DrawText(target, *font->GetFont(), x, y + font->height,
              color, NULL, text, font->kerning);
+
+    // Font width set to width of rendered glyph
+    // without any padding, account for this
+    length = textLen * (font->width + 1);
   }
+
+  // Remove trailing space
+  return length - 1;
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "frameexport.h"
+#include "logger.h"
+#include "trace.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+FrameExport::FrameExport(rgb_matrix::Canvas *display) : display(display),
+  frame(display->width(), display->height()) {}
+
+FrameExport::~FrameExport()
+{
+  close();
+}
+
+// Create (or reuse) our ring file, and map it.  Readers with
+// an older map of the same file keep working across restarts.
+bool FrameExport::open(const char *path)
+{
+  size_t frameSize = (size_t) width() * height() * 3;
+  uint32_t slotSize = (sizeof(FrameSlot) + frameSize + FRAMES_ALIGN - 1) & ~(FRAMES_ALIGN - 1);
+  FramesFileHeader layout = {};
+  layout.slotSize = slotSize;
+  mapSize = frameSlotOffset(&layout, FRAMES_RING);
+
+  fd = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    _error("unable to open frames file %s", path);
+    return false;
+  }
+
+  if (ftruncate(fd, mapSize) != 0) {
+    _error("unable to size frames file %s", path);
+    close();
+    return false;
+  }
+
+  void *map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    _error("unable to map frames file %s", path);
+    close();
+    return false;
+  }
+  header = (FramesFileHeader *) map;
+
+  // Readers check the magic last, once the layout is valid
+  header->magic = 0;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->version = FRAMES_VERSION;
+  header->width = width();
+  header->height = height();
+  header->ring = FRAMES_RING;
+  header->slotSize = slotSize;
+  header->latest.store(0, std::memory_order_relaxed);
+  for (uint32_t i = 0; i < FRAMES_RING; i++) {
+    auto slot = (FrameSlot *) ((char *) header + frameSlotOffset(header, i));
+    slot->seq.store(0, std::memory_order_relaxed);
+    slot->number = 0;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = FRAMES_MAGIC;
+
+  _log("frames: exporting %dx%d frames to %s", width(), height(), path);
+
+  // Publish what is already drawn
+  changed = true;
+  return true;
+}
+
+void FrameExport::close()
+{
+  if (header)
+    munmap(header, mapSize);
+  if (fd >= 0)
+    ::close(fd);
+  header = NULL;
+  fd = -1;
+}
+
+// Copy our frame to the next slot of the ring, if it has changed
+void FrameExport::publish()
+{
+  if (!changed || header == NULL)
+    return;
+
+  TRACE_SPAN("publishFrame");
+  number++;
+  auto slot = (FrameSlot *) ((char *) header +
+      frameSlotOffset(header, (number - 1) % FRAMES_RING));
+  uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+
+  slot->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->number = number;
+  slot->time = std::chrono::duration_cast<std::chrono::microseconds>(
+      system_clock::now().time_since_epoch()).count();
+  memcpy((void *) (slot + 1), frame.getPixel(0, 0), (size_t) width() * height() * 3);
+  slot->seq.store(seq + 2, std::memory_order_release);
+
+  header->latest.store(number, std::memory_order_release);
+  changed = false;
+}
+
+void FrameExport::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b)
+{
+  display->SetPixel(x, y, r, g, b);
+  frame.SetPixel(x, y, r, g, b);
+  changed = true;
+}
+
+void FrameExport::Clear()
+{
+  display->Clear();
+  frame.Fill(0, 0, 0);
+  changed = true;
+}
+
+void FrameExport::Fill(uint8_t r, uint8_t g, uint8_t b)
+{
+  display->Fill(r, g, b);
+  frame.Fill(r, g, b);
+  changed = true;
+}
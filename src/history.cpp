@@ -0,0 +1,198 @@
+#include "history.h"
+#include "logger.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+// Histories of our sensors, named after their widgets
+static SensorHistory histories[HISTORY_MAX_SENSORS];
+static uint8_t numHistories = 0;
+
+
+SensorHistory::SensorHistory()
+{
+  tiers[0] = {0, 0, HISTORY_RAW_SAMPLES};
+  tiers[1] = {300, HISTORY_RAW_SAMPLES, HISTORY_5MIN_SAMPLES};
+  tiers[2] = {3600, HISTORY_RAW_SAMPLES + HISTORY_5MIN_SAMPLES, HISTORY_1H_SAMPLES};
+}
+
+void SensorHistory::setName(const char *value)
+{
+  strncpy(name, value, HISTORY_NAME_LEN);
+  name[HISTORY_NAME_LEN] = '\0';
+}
+
+const char* SensorHistory::getName() const {
+  return name;
+}
+
+void SensorHistory::push(HistoryTier &tier, const HistorySample &value)
+{
+  samples[tier.start + tier.head] = value;
+  tier.head = (tier.head + 1) % tier.capacity;
+  if (tier.count < tier.capacity)
+    tier.count++;
+}
+
+// A sample of a tier, by age: 0 is the newest
+const HistorySample& SensorHistory::sample(const HistoryTier &tier, uint16_t age) const
+{
+  return samples[tier.start + (tier.head + tier.capacity - 1 - age) % tier.capacity];
+}
+
+// The finest tier holding samples back to a time, either as
+// it reaches back that far or hasn't yet dropped any
+const HistoryTier& SensorHistory::tierFor(uint32_t since) const
+{
+  for (int i = 0; i < HISTORY_TIERS - 1; i++)
+  {
+    const HistoryTier &tier = tiers[i];
+    if (tier.count < tier.capacity || sample(tier, tier.count - 1).time <= since)
+      return tier;
+  }
+  return tiers[HISTORY_TIERS - 1];
+}
+
+// Record a value, older than our latest are dropped
+void SensorHistory::add(system_clock::time_point time, float value)
+{
+  uint32_t now = system_clock::to_time_t(time);
+
+  if (tiers[0].count && now < sample(tiers[0], 0).time) {
+    _debug("history %s: dropping sample older than our latest", name);
+    return;
+  }
+
+  push(tiers[0], {now, value, value, value});
+
+  // Write each tier's period once a value arrives for the next
+  for (int i = 1; i < HISTORY_TIERS; i++)
+  {
+    HistoryTier &tier = tiers[i];
+    uint32_t start = now - now % tier.period;
+
+    if (tier.pendingCount && tier.pending.time != start) {
+      tier.pending.value = tier.pendingSum / tier.pendingCount;
+      push(tier, tier.pending);
+      tier.pendingCount = 0;
+    }
+
+    if (tier.pendingCount == 0) {
+      tier.pending = {start, value, value, value};
+      tier.pendingSum = 0;
+    }
+    tier.pending.min = std::min(tier.pending.min, value);
+    tier.pending.max = std::max(tier.pending.max, value);
+    tier.pendingSum += value;
+    tier.pendingCount++;
+  }
+
+  changes++;
+}
+
+bool SensorHistory::latest(HistorySample *out) const
+{
+  if (tiers[0].count == 0)
+    return false;
+
+  *out = sample(tiers[0], 0);
+  return true;
+}
+
+// The value at a time: the newest sample at or before it
+bool SensorHistory::valueAt(uint32_t time, float *value) const
+{
+  const HistoryTier &tier = tierFor(time);
+
+  for (uint16_t age = 0; age < tier.count; age++)
+  {
+    const HistorySample &s = sample(tier, age);
+    if (s.time <= time) {
+      *value = s.value;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Lowest and highest values over a window, up to our latest
+bool SensorHistory::range(std::chrono::seconds window, float *min, float *max) const
+{
+  HistorySample last;
+  if (!latest(&last))
+    return false;
+
+  uint32_t since = last.time - std::min<uint32_t>(last.time, window.count());
+  const HistoryTier &tier = tierFor(since);
+  *min = *max = last.value;
+
+  // Periods overlapping the window, then the raw samples which
+  // cover the most recent (and our current period)
+  for (uint16_t age = 0; age < tier.count; age++)
+  {
+    const HistorySample &s = sample(tier, age);
+    if (s.time + tier.period < since)
+      break;
+    *min = std::min(*min, s.min);
+    *max = std::max(*max, s.max);
+  }
+  if (tier.pendingCount) {
+    *min = std::min(*min, tier.pending.min);
+    *max = std::max(*max, tier.pending.max);
+  }
+  for (uint16_t age = 0; &tier != &tiers[0] && age < tiers[0].count; age++)
+  {
+    const HistorySample &s = sample(tiers[0], age);
+    if (s.time < since)
+      break;
+    *min = std::min(*min, s.value);
+    *max = std::max(*max, s.value);
+  }
+  return true;
+}
+
+// Whether our latest value has risen (1) or fallen (-1) by at
+// least a threshold since the start of a window, or neither (0).
+// With less history than the window, we compare to the oldest.
+int8_t SensorHistory::trend(float threshold, std::chrono::seconds window) const
+{
+  HistorySample last;
+  if (!latest(&last))
+    return 0;
+
+  uint32_t since = last.time - std::min<uint32_t>(last.time, window.count());
+  float past;
+  if (!valueAt(since, &past))
+  {
+    const HistoryTier &tier = tierFor(since);
+    const HistoryTier &oldest = tier.count ? tier : tiers[0];
+    past = sample(oldest, oldest.count - 1).value;
+  }
+
+  float delta = last.value - past;
+  if (delta > 0 && delta >= threshold)
+    return 1;
+  if (delta < 0 && -delta >= threshold)
+    return -1;
+  return 0;
+}
+
+// Find the history of a sensor, or start one
+SensorHistory* findHistory(const char *name)
+{
+  for (uint8_t i = 0; i < numHistories; i++) {
+    if (strncmp(histories[i].getName(), name, HISTORY_NAME_LEN) == 0)
+      return &histories[i];
+  }
+
+  if (numHistories == HISTORY_MAX_SENSORS) {
+    _error("unable to keep history of %s, limit of %d sensors reached",
+        name, HISTORY_MAX_SENSORS);
+    return NULL;
+  }
+
+  _debug("history %s: starting", name);
+  histories[numHistories].setName(name);
+  return &histories[numHistories++];
+}
@@ -0,0 +1,81 @@
+#include "iconcache.h"
+#include "taskpool.h"
+#include "logger.h"
+#include "trace.h"
+
+#include <png++/png.hpp>
+#include <sys/stat.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+static std::mutex iconMutex;
+static std::map<std::string, std::shared_future<const IconImage *>> iconCache;
+
+
+// Decode a PNG image to an RGB pixel array
+static const IconImage* decodeIcon(std::string iconFile)
+{
+  TRACE_SPAN_ARG("decodePNG", iconFile.c_str());
+  png::image<png::rgb_pixel> image;
+
+  struct stat buffer;
+  if (stat(iconFile.c_str(), &buffer) != 0) {
+    _error("image %s not found", iconFile.c_str());
+    return NULL;
+  }
+  image.read(iconFile);
+
+  IconImage *icon = new IconImage;
+  icon->width = image.get_width();
+  icon->height = image.get_height();
+  icon->pixels = new uint8_t[icon->width * icon->height * 3];
+
+  uint32_t idx = 0;
+  for (uint32_t y = 0; y < icon->height; y++) {
+    for (uint32_t x = 0; x < icon->width; x++) {
+      png::rgb_pixel pixel = image.get_pixel(x, y);
+      icon->pixels[idx++] = pixel.red;
+      icon->pixels[idx++] = pixel.green;
+      icon->pixels[idx++] = pixel.blue;
+    }
+  }
+
+  return icon;
+}
+
+// Find an icon in our cache, or start decoding it, either
+// on the task pool or immediately if it's needed now
+static std::shared_future<const IconImage *> findIcon(const char *iconFile, bool async)
+{
+  std::lock_guard<std::mutex> lock(iconMutex);
+
+  auto icon = iconCache.find(iconFile);
+  if (icon != iconCache.end())
+    return icon->second;
+
+  std::string file(iconFile);
+  std::shared_future<const IconImage *> future;
+  if (async) {
+    future = taskPool.submit([file]() { return decodeIcon(file); });
+  } else {
+    std::promise<const IconImage *> decoded;
+    future = decoded.get_future().share();
+    decoded.set_value(decodeIcon(file));
+  }
+
+  iconCache[file] = future;
+  return future;
+}
+
+void preloadIcons(std::initializer_list<const char *> iconFiles)
+{
+  for (auto iconFile : iconFiles)
+    findIcon(iconFile, true);
+}
+
+const IconImage* loadIcon(const char *iconFile)
+{
+  return findIcon(iconFile, false).get();
+}
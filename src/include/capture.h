@@ -0,0 +1,69 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "smartgirder.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// Recording of the MQTT messages we receive, for replaying
+// a real sequence of messages off the device with girderreplay.
+// The file is a header followed by one record per message,
+// each record followed by its topic and payload bytes.
+// Captures are named files in CAPTURE_DIR, and stop once
+// they reach CAPTURE_MAX_SIZE, as the directory is in memory
+#define CAPTURE_DIR           "/dev/shm"
+#define CAPTURE_NAME          "smartgirder.capture"
+#define CAPTURE_NAME_LEN      64
+#define CAPTURE_MAX_SIZE      (8 << 20)
+#define CAPTURE_MAGIC         0x50434753    // "SGCP"
+#define CAPTURE_VERSION       1
+#define CAPTURE_FLUSH_PERIOD  1s
+#define CAPTURE_BUFFER_SIZE   65536
+
+struct CaptureFileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  int64_t started;                  // Unix time (ms)
+};
+
+struct __attribute__((packed)) CaptureRecord
+{
+  uint32_t time;                    // Since capture start (ms)
+  uint16_t topicLength;
+  uint32_t payloadLength;
+};
+
+struct CaptureMessage
+{
+  uint32_t time;
+  std::string topic;
+  std::vector<char> payload;
+};
+
+bool startCapture(const char *name = CAPTURE_NAME);
+void stopCapture(void);
+bool capturing(void);
+void captureMessage(const char *topic, const char *payload, int length);
+void checkFlushCapture(void);
+
+// Reads back the messages of a capture file
+class CaptureReader
+{
+private:
+  FILE *file = NULL;
+  CaptureFileHeader header = {};
+
+public:
+  ~CaptureReader();
+
+  bool open(const char *path);
+  bool next(CaptureMessage &msg);
+  int64_t started() const { return header.started; }
+};
+
+#endif
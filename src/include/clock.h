@@ -0,0 +1,67 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "smartgirder.h"
+#include "textcache.h"
+
+#include <time.h>
+
+#define CLOCK_LINE_CELLS      8
+#define CLOCK_GLYPHS          "0123456789:/"
+#define CLOCK_NUM_GLYPHS      12
+#define CLOCK_SHOW_SECONDS    false
+#define CLOCK_SECONDS_ROW     31
+
+// A glyph (or word) drawn at a position in the clock
+struct ClockCell
+{
+  TextRun *sprite = NULL;
+  int16_t x = 0;
+
+  bool operator==(const ClockCell &other) const {
+    return sprite == other.sprite && x == other.x;
+  }
+};
+
+// Cells currently drawn on one line of the clock
+struct ClockLine
+{
+  uint8_t count = 0;
+  ClockCell cells[CLOCK_LINE_CELLS];
+};
+
+// Renders the day of week, date and time from sprites
+// rasterized once at startup.  On each update only the
+// cells that changed are erased and redrawn, and we only
+// wake when the minute (or second) changes.
+class ClockRenderer
+{
+private:
+  enum clockLineType{LINE_DAY, LINE_DATE, LINE_TIME, NUM_LINES};
+
+  bool init = false;
+  bool showSeconds = CLOCK_SHOW_SECONDS;
+  TextRun weekdays[7];
+  TextRun dateGlyphs[CLOCK_NUM_GLYPHS];
+  TextRun timeGlyphs[CLOCK_NUM_GLYPHS];
+  ClockLine lines[NUM_LINES];
+  int8_t secondsX = -1;
+  system_clock::time_point nextUpdate;
+  system_clock::time_point fixedTime;
+
+  void initSprites();
+  TextRun* glyphSprite(TextRun *glyphs, char glyph);
+  void layoutGlyphs(ClockLine &line, TextRun *glyphs, const char *text);
+  void updateLine(clockLineType type, ClockLine &line, uint8_t y);
+  void updateSeconds(uint8_t second, bool force);
+
+public:
+  void render(bool force = false);
+  void setShowSeconds(bool);
+  void setFixedTime(system_clock::time_point);
+  milliseconds nextUpdateIn();
+};
+
+extern ClockRenderer clockRenderer;
+
+#endif
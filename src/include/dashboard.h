@@ -5,7 +5,21 @@
 #define WEATHER_MAX_LEN 32
 #define MAX_WIDGETS 32
 
+#include "panel.h"
+
 void setupDashboard();
-void displayDashboard(bool force=false);
+void renderFrame();
+
+// Our widgets are globals, so there is a single dashboard
+// layout, shown on one panel
+class DashboardLayout : public PanelLayout
+{
+public:
+  void render();
+  milliseconds nextUpdateIn();
+  void logStats();
+};
+
+extern DashboardLayout dashboardLayout;
 
 #endif
\ No newline at end of file
@@ -6,11 +6,27 @@
 
 #include "font.h"
 
+// Size of the composite panel, in all configs
+#define DISPLAY_WIDTH   128
+#define DISPLAY_HEIGHT  64
+
+// Config to preview in a terminal, on any machine
+#define DISPLAY_CONFIG_TERMINAL   4
+
+// Frame canvas that widgets are composited into, each
+// panel's render thread draws to its own
+extern thread_local rgb_matrix::Canvas *canvas;
+
 bool setupDisplay(uint8_t configNum);
+bool setupOffscreenDisplay(rgb_matrix::Canvas *target);
+bool setupTerminalDisplay();
+void presentDisplay();
 void shutdownDisplay();
 void setBrightness(uint8_t brightness);
-void drawRect(uint16_t, uint16_t, uint16_t, uint16_t, Color);
-void drawIcon(int, int, int, int, const uint8_t *);
+void drawRect(uint16_t, uint16_t, uint16_t, uint16_t, Color,
+              rgb_matrix::Canvas* = NULL);
+void drawIcon(int, int, int, int, const uint8_t *,
+              rgb_matrix::Canvas* = NULL);
 void displayClock(bool = false);
 
 #endif
\ No newline at end of file
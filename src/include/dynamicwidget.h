@@ -4,6 +4,7 @@
 #include "smartgirder.h"
 #include "widget.h"
 #include "display.h"
+#include "history.h"
 
 #include <graphics.h>
 #include <time.h>
@@ -11,6 +12,7 @@
 
 #define TEXT_UPDATE_PERIOD_MS     5s
 #define FRAME_UPDATE_PERIOD_MS    900ms
+#define MULTILINE_MAX_LINES       16
 
 // Sub-class to implement a widget that can change
 // the display of rendered contents.  Currently only
@@ -22,10 +24,22 @@ private:
   system_clock::time_point lastUpdateTime;
   milliseconds textUpdatePeriod = TEXT_UPDATE_PERIOD_MS;
   uint8_t currentTextLine = 0;
-  char fullTextData[WIDGET_TEXT_LEN+1];
+  char fullTextData[WIDGET_TEXT_LEN+1] = "";
+
+  // Start/length of each line within fullTextData,
+  // indexed once when our text is set
+  uint8_t numLines = 0;
+  uint16_t lineStart[MULTILINE_MAX_LINES];
+  uint16_t lineLength[MULTILINE_MAX_LINES];
+
+  // Display time of each line, from our text, zero
+  // uses textUpdatePeriod
+  milliseconds lineDwell[MULTILINE_MAX_LINES] = {};
 
   virtual void setText(char *);
+  void loadTextLine();
   void doTextUpdate();
+  milliseconds dwellTime(uint8_t line);
 
 public:
   MultilineWidget(const char *name):DashboardWidget(name) {}
@@ -35,6 +49,8 @@ public:
   void setTextUpdatePeriod(milliseconds period);
   void checkTextUpdate();
   void checkUpdate();
+  milliseconds nextUpdateIn();
+  void setVisible(bool);
 };
 
 class AnimatedWidget : public DashboardWidget
@@ -54,6 +70,33 @@ public:
   void setImageUpdatePeriod(milliseconds period);
   void checkImageUpdate();
   void checkUpdate();
+  milliseconds nextUpdateIn();
+  void setVisible(bool);
+};
+
+// Shows whether a sensor's value is rising or falling, as
+// an arrow icon, from its history.  Optionally shows the
+// range of its values over a window as our text.
+class TrendWidget : public DashboardWidget
+{
+private:
+  SensorHistory *source = NULL;
+  float threshold = 1.0;
+  std::chrono::seconds window = HISTORY_TREND_WINDOW;
+  std::chrono::seconds rangeWindow = 0s;
+  uint32_t seenVersion = 0;
+  int8_t trend = 0;
+
+  void doTrendUpdate();
+  int renderText();
+
+public:
+  TrendWidget(const char *name) : DashboardWidget(name) {}
+
+  void setSource(SensorHistory *history, float threshold,
+      std::chrono::seconds window = HISTORY_TREND_WINDOW);
+  void setRange(std::chrono::seconds window);
+  void checkUpdate();
 };
 
 // Clock widget
@@ -57,10 +57,18 @@ public:
   }
 
   void LoadFont(fonts newFont);
+
+  // Load on the task pool at startup, the font can't be
+  // used for drawing until waitForFonts() has returned
+  void LoadFontAsync(fonts newFont);
 };
 
+void waitForFonts();
+
+uint8_t vGlyphWidth(const char glyph, GirderFont *font, bool = false);
 uint16_t textRenderLength(const char *text, GirderFont *font);
-void drawText(uint8_t, uint8_t, Color, const char *,
-              GirderFont* = NULL, bool = false, bool = false);
+uint16_t drawText(uint8_t, uint8_t, Color, const char *,
+              GirderFont* = NULL, bool = false, bool = false,
+              rgb_matrix::Canvas* = NULL);
 
 #endif
\ No newline at end of file
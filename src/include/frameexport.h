@@ -0,0 +1,84 @@
+#ifndef FRAMEEXPORT_H
+#define FRAMEEXPORT_H
+
+#include "smartgirder.h"
+#include "surface.h"
+
+#include <canvas.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+
+// The frames shown on a panel, published to a ring in shared
+// memory for viewers and recorders (see girderframes).  Each
+// frame is written to the next slot of the ring, so readers
+// have a few frames' time to copy one, and we never wait on
+// them.  The file is the header followed by the slots, each a
+// FrameSlot followed by the frame's RGB pixels.
+#define FRAMES_PATH         "/dev/shm/smartgirder.frames"
+#define FRAMES_MAGIC        0x52464753    // "SGFR"
+#define FRAMES_VERSION      1
+#define FRAMES_RING         4
+#define FRAMES_ALIGN        64
+
+// A frame in the ring, guarded by a sequence lock.  seq is odd
+// while the frame is written; readers copy the frame and retry
+// if seq changed or was odd meanwhile.
+struct FrameSlot
+{
+  std::atomic<uint32_t> seq;
+  uint32_t number;                  // Frame number, from 1
+  int64_t time;                     // Unix time (us)
+};
+
+struct FramesFileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint16_t width;
+  uint16_t height;
+  uint32_t ring;                    // Number of slots
+  uint32_t slotSize;                // Bytes per slot, with its pixels
+  std::atomic<uint32_t> latest;     // Number of the newest frame
+};
+
+// Offset of a slot in the file
+inline size_t frameSlotOffset(const FramesFileHeader *header, uint32_t slot)
+{
+  size_t start = (sizeof(FramesFileHeader) + FRAMES_ALIGN - 1) & ~(FRAMES_ALIGN - 1);
+  return start + (size_t) slot * header->slotSize;
+}
+
+// Sits between a panel and its display, passing pixels through
+// and keeping a copy of the frame, which is published after each
+// frame that drew anything
+class FrameExport : public rgb_matrix::Canvas
+{
+private:
+  rgb_matrix::Canvas *display;
+  Surface frame;
+  bool changed = false;
+
+  int fd = -1;
+  FramesFileHeader *header = NULL;
+  size_t mapSize = 0;
+  uint32_t number = 0;
+
+public:
+  FrameExport(rgb_matrix::Canvas *display);
+  ~FrameExport();
+
+  bool open(const char *path = FRAMES_PATH);
+  void close();
+  void publish();
+
+  // rgb_matrix::Canvas interface
+  int width() const { return display->width(); }
+  int height() const { return display->height(); }
+  void SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
+  void Clear();
+  void Fill(uint8_t r, uint8_t g, uint8_t b);
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "smartgirder.h"
+
+#include <stdint.h>
+
+#define HISTORY_MAX_SENSORS   16
+#define HISTORY_NAME_LEN      32
+
+// Samples kept by each tier of a sensor's history: every value
+// received, then averages over 5 minutes (a day) and an hour
+// (a week).  Each sensor's history is a fixed 9.3KB.
+#define HISTORY_RAW_SAMPLES   128
+#define HISTORY_5MIN_SAMPLES  288
+#define HISTORY_1H_SAMPLES    168
+#define HISTORY_SAMPLES       (HISTORY_RAW_SAMPLES + HISTORY_5MIN_SAMPLES + HISTORY_1H_SAMPLES)
+#define HISTORY_TIERS         3
+
+// Default time a trend is measured over
+#define HISTORY_TREND_WINDOW  30min
+
+
+// A value at a time, or for downsampled tiers the average,
+// minimum and maximum of the values in the period starting
+// at that time
+struct HistorySample
+{
+  uint32_t time;                    // Unix time (s)
+  float value;
+  float min;
+  float max;
+};
+
+// A ring of samples, within its history's samples, and the
+// sample being accumulated for the current period
+struct HistoryTier
+{
+  uint32_t period;                  // Seconds per sample, 0 keeps each
+  uint16_t start;                   // First of our samples
+  uint16_t capacity;
+  uint16_t head = 0;                // Next sample written
+  uint16_t count = 0;
+
+  HistorySample pending = {};
+  float pendingSum = 0;
+  uint32_t pendingCount = 0;
+};
+
+// Recent values of a sensor, kept in fixed memory.  Adding a
+// value writes the raw tier and folds it into the period of
+// each downsampled tier, which is written when the next period
+// starts, so is constant time.  Queries use the finest tier
+// that still covers the time asked about.
+class SensorHistory
+{
+private:
+  char name[HISTORY_NAME_LEN+1] = "";
+  HistorySample samples[HISTORY_SAMPLES];
+  HistoryTier tiers[HISTORY_TIERS];
+  uint32_t changes = 0;
+
+  void push(HistoryTier &tier, const HistorySample &value);
+  const HistorySample& sample(const HistoryTier &tier, uint16_t age) const;
+  const HistoryTier& tierFor(uint32_t since) const;
+
+public:
+  SensorHistory();
+
+  void setName(const char *);
+  const char* getName() const;
+
+  void add(system_clock::time_point time, float value);
+  bool latest(HistorySample *out) const;
+  bool valueAt(uint32_t time, float *value) const;
+  bool range(std::chrono::seconds window, float *min, float *max) const;
+  int8_t trend(float threshold, std::chrono::seconds window = HISTORY_TREND_WINDOW) const;
+
+  // Changes each time a value is added
+  uint32_t version() const { return changes; }
+};
+
+SensorHistory* findHistory(const char *name);
+
+#endif
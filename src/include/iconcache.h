@@ -0,0 +1,23 @@
+#ifndef ICONCACHE_H
+#define ICONCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <initializer_list>
+
+// A decoded PNG icon, as RGB pixel data
+struct IconImage
+{
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint8_t *pixels = NULL;
+};
+
+// Icons are decoded once and kept for the life of the program.
+// Preloading decodes them on the task pool, later lookups wait
+// for the decode to finish if it's still in progress.
+void preloadIcons(std::initializer_list<const char *> iconFiles);
+const IconImage* loadIcon(const char *iconFile);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Most levels of nesting we follow for paths, deeper
+// values are skipped over, and most we parse at all
+#define JSON_MAX_DEPTH      8
+#define JSON_MAX_NESTING    32
+#define JSON_MAX_PATHS      16
+
+enum jsonType{JSON_NONE, JSON_NULL, JSON_BOOL, JSON_NUMBER,
+  JSON_STRING, JSON_OBJECT, JSON_ARRAY};
+
+// A value found in a JSON document, pointing into the document
+// itself.  Strings exclude their quotes and are still escaped.
+struct JsonValue
+{
+  jsonType type = JSON_NONE;
+  const char *start = NULL;
+  size_t length = 0;
+};
+
+// Find the values at several paths (eg. "attributes.temperature",
+// "forecast[0].condition") in a single pass over a JSON document,
+// without allocating or modifying it.  Returns the number found.
+uint8_t jsonExtract(const char *json, size_t length, const char *const *paths,
+  JsonValue *values, uint8_t count);
+
+// Copy a value as text, decoding string escapes, returns its length
+size_t jsonValueText(const JsonValue &value, char *buffer, size_t size);
+
+#endif
@@ -2,7 +2,10 @@
 #define LOGGER_H
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <string>
+#include <atomic>
+#include <chrono>
 
 #define TERM_RED      "\033[1;31m"
 #define TERM_YELLOW   "\033[1;33m"
@@ -12,11 +15,60 @@
 #define LOG_TO_FILE   true
 #define LOG_PATH      "/dev/shm/smartgirder.log"
 
+// The log file is a fixed-size circular buffer mapped into
+// memory, so it never grows beyond this (rounded down to a
+// power of 2).  Read it in order with tools/girderlog.
+#ifndef LOG_FILE_SIZE
+#define LOG_FILE_SIZE     (1024 * 1024)
+#endif
+#define LOG_FILE_MAGIC    0x474c4753    // "SGLG"
+#define LOG_FILE_VERSION  1
+
+// Messages are queued in a ring buffer and written
+// by a background thread, off the render thread.
+// If the ring is full, messages are dropped (and counted).
+#define LOG_RING_SLOTS    512         // Must be a power of 2
+#define LOG_MSG_LEN       240
+
+// Log levels, messages above LOG_LEVEL are compiled out
+// Build with -DLOG_LEVEL=LOG_LEVEL_INFO to remove debug logging
+#define LOG_LEVEL_ERROR   0
+#define LOG_LEVEL_WARN    1
+#define LOG_LEVEL_INFO    2
+#define LOG_LEVEL_DEBUG   3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL         LOG_LEVEL_DEBUG
+#endif
+
 #define __METHOD__          methodName(__PRETTY_FUNCTION__, "")
 #define __METHOD_ARG__(arg) methodName(__PRETTY_FUNCTION__, arg)
 
-void initLogger(void);
+// Header at the start of the log file, followed by
+// the log data.  head is the total bytes written (mod 2^32),
+// data is written at head % capacity and wraps around.
+struct LogFileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t headerSize;
+  uint32_t capacity;
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> wrapped;
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+    "log file header requires lock-free atomics");
+
+// State for rate-limited messages, one per call site
+struct LogLimit
+{
+  std::atomic<int64_t> next{0};
+  std::atomic<uint32_t> suppressed{0};
+};
+
+void initLogger(size_t logSize = LOG_FILE_SIZE);
 void shutdownLogger(void);
+void setConsoleLogging(bool enabled);
 void _error(const char *fmt, ...);
 void _error(std::string fmt, ...);
 void _warn(const char *fmt, ...);
@@ -25,7 +77,28 @@ void _debug(const char *fmt, ...);
 void _debug(std::string fmt, ...);
 void _log(const char *fmt, ...);
 void _log(std::string fmt, ...);
-void __logHelper(const char *header, const char *fmt, va_list argptr);
+void __logHelper(uint8_t level, const char *fmt, va_list argptr);
+bool __logRateLimit(LogLimit &limit, std::chrono::milliseconds interval);
 std::string methodName(const std::string& prettyFunction, std::string arg);
 
-#endif
\ No newline at end of file
+// Compile-time level filtering, arguments are not evaluated
+#if LOG_LEVEL < LOG_LEVEL_DEBUG
+#define _debug(...)       ((void) 0)
+#endif
+#if LOG_LEVEL < LOG_LEVEL_INFO
+#define _log(...)         ((void) 0)
+#endif
+#if LOG_LEVEL < LOG_LEVEL_WARN
+#define _warn(...)        ((void) 0)
+#endif
+
+// Warn at most once per interval from this call site, for
+// messages that can repeat on every frame/update
+#define _warnLimited(interval, ...)                 \
+  do {                                              \
+    static LogLimit __limit;                        \
+    if (__logRateLimit(__limit, interval))          \
+      _warn(__VA_ARGS__);                           \
+  } while (0)
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef MQTT_H
 #define MQTT_H
 
+#include "smartgirder.h"
+
 #include <mosquitto.h>
+#include <stdint.h>
 
 // MQTT topics
 #define HASS_OUT_TEMP       "homeassistant/sensor/outdoor_temperature/state"
@@ -9,6 +12,9 @@
 #define HASS_OUT_PM25       "homeassistant/sensor/outdoor_pm_25m/state"
 #define HASS_LR_TEMP        "homeassistant/sensor/living_room_temperature/state"
 #define HASS_LR_DEW         "homeassistant/sensor/living_room_dew_point/state"
+#define HASS_LR_VOC         "homeassistant/sensor/living_room_voc_index/state"
+#define HASS_GARAGE         "homeassistant/cover/garage_door/state"
+#define HASS_CHORES         "homeassistant/sensor/chores/state"
 #define PIWEATHER_WIND      "piweather/wind_speed_mph"
 #define PIWEATHER_MAX_WIND  "piweather/max_wind_speed_mph"
 #define PIWEATHER_RAINFALL  "piweather/rainfall_last_hour"
@@ -17,19 +23,38 @@
 #define WEATHER_NOW_STATE   "weather/current/state"
 #define WEATHER_SUN         "weather/sun"
 #define WEATHER_ALERT       "weather/alert"
+#define WEATHER_ATTRIBUTES  "weather/current/attributes"
 #define THERMOSTAT_STATE    "thermostat/state"
 #define CALENDAR_EVENT      "calendar/event"
 #define SIGN_BRIGHTNESS     "sign/brightness"
 #define DEBUG_WIDGET        "debug/widget"
 #define DEBUG_SCROLL_DELAY  "debug/scroll/delay"
 #define DEBUG_SCROLL_STATE  "debug/scroll/state"
+#define DEBUG_TRACE         "debug/trace"
+#define DEBUG_CAPTURE       "debug/capture"
+#define DEBUG_PAGE          "debug/page"
 
 #define MQTT_HOST           "10.4.5.2"
+#define MQTT_HOST_ENV       "GIRDER_MQTT_HOST"  // Overrides MQTT_HOST
 
 #define MQTT_CLIENT_DEFAULT     "girder"
 #define MQTT_CLIENT_ID_LEN      64
-#define MQTT_CONNECT_WAIT       1
-#define MQTT_CONNECT_WAIT_MAX   60
+
+// Reconnect backoff, doubled after each failed attempt up to
+// the max, with a random wait of up to half of it subtracted
+#define MQTT_CONNECT_WAIT       1s
+#define MQTT_CONNECT_WAIT_MAX   60s
+#define MQTT_CONNECT_TIMEOUT    10s
+
+// Consecutive failures before we build a new client
+#define MQTT_REBUILD_FAILURES   5
+
+// Most topic aliases the broker may assign us
+#define MQTT_TOPIC_ALIAS_MAX    32
+
+// How long the broker keeps our session (subscriptions and
+// queued QoS 1 messages) while we're disconnected, in seconds
+#define MQTT_SESSION_EXPIRY     86400
 
 
 extern volatile bool girderRunning;
@@ -37,21 +62,66 @@ extern char mqtt_username[];
 extern char mqtt_password[];
 
 
+enum mqttStateType{MQTT_DISCONNECTED, MQTT_CONNECTING, MQTT_CONNECTED};
+
 // Struct to store MQTT connection/config
 struct st_mqttClient {
   mosquitto *client;
-  bool connected;
+  mqttStateType state;
+  bool hostSet;                   // Client has connected before
+  bool subscribed;                // Subscribed since we started
   char *server;
   unsigned int port;
   unsigned int keepalive;
   char clientId[MQTT_CLIENT_ID_LEN];
+  uint32_t messages;              // Count of messages received
+
+  // Reconnect state
+  uint32_t failures;              // Consecutive failed attempts
+  steady_clock::time_point stateTime;
+  steady_clock::time_point nextAttempt;
+  steady_clock::time_point downSince;
+
+  // Stats, reset when logged
+  uint32_t attempts;
+  uint32_t disconnects;
+  uint32_t rebuilds;
+  steady_clock::duration downtime;
+  uint32_t statsMessages;
+};
+
+// A value within a JSON message, passed to its handler as
+// if it were the whole payload of a topic
+struct JsonBinding {
+  const char *path;
+  void (*handler)(char *value);
 };
 
+// A topic we subscribe to, and the function handling its messages.
+// JSON topics instead list the values to extract from them, each
+// stored and handled separately.
+struct TopicHandler {
+  const char *topic;
+  uint8_t qos;
+  void (*handler)(char *payload);
+  const JsonBinding *bindings = NULL;
+  uint8_t numBindings = 0;
+};
+
+extern const TopicHandler topicHandlers[];
+extern const uint8_t numTopicHandlers;
+
 // Prototype defs
 void mqttOnMessage(struct mosquitto *, void *, const struct mosquitto_message *);
+void mqttOnMessageV5(struct mosquitto *, void *, const struct mosquitto_message *,
+  const mosquitto_property *);
 void showMessage(char *, char *);
 int createMqttClient();
-int mqttConnect();
+void mqttCheckConnection();
+void mqttConnectionLost(int rc);
+bool mqttClientReady();
+void mqttWait(milliseconds timeout);
+void mqttLogStats();
 void mqttShutdown();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,102 @@
+#ifndef PAGE_H
+#define PAGE_H
+
+#include "smartgirder.h"
+#include "surface.h"
+#include "widgetmanager.h"
+
+#include <canvas.h>
+#include <stdint.h>
+
+#include <vector>
+
+#define PAGE_MAX            4
+#define PAGE_NONE           -1
+
+// Time each page is shown for when rotating, by default
+#define PAGE_DWELL          20s
+#define PAGE_ROTATE         true
+
+// Pages slide in from the right when swapped by rotation,
+// drawing a frame of the slide every period
+#define PAGE_SLIDE          true
+#define PAGE_SLIDE_TIME     400ms
+#define PAGE_FRAME_PERIOD   20ms
+
+
+// A page's cached canvas, tracking the span of each row drawn
+// since it was last presented, so only those are copied to
+// the display
+class PageSurface : public Surface
+{
+private:
+  std::vector<int16_t> spanStart;
+  std::vector<int16_t> spanEnd;     // Exclusive, start == end is clean
+
+public:
+  PageSurface(int w, int h);
+
+  void SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
+  void Clear();
+  void Fill(uint8_t r, uint8_t g, uint8_t b);
+
+  void markDirty();
+  void present(rgb_matrix::Canvas *out);
+  void blit(rgb_matrix::Canvas *out, int offsetX = 0);
+};
+
+// A named set of widgets shown together, composited into its
+// own canvas.  Only one page may show the clock, as it keeps
+// track of what it has drawn.
+class Page
+{
+public:
+  const char *name;
+  WidgetManager *widgets;
+  bool clock;
+  milliseconds dwell;
+  PageSurface cache;
+
+  Page(const char *name, WidgetManager *widgets, bool clock = false,
+      milliseconds dwell = PAGE_DWELL);
+};
+
+// Keeps every page's canvas up to date, and shows one of them,
+// rotating through pages with data.  Hidden pages apply updates
+// from messages, but skip timed updates (animations, scrolling)
+// which catch up once shown.  Swapping pages only copies the
+// cached canvas of the new page to the display.
+class PageManager
+{
+private:
+  Page *pages[PAGE_MAX];
+  uint8_t numPages = 0;
+  uint8_t shown = 0;
+  int8_t leaving = PAGE_NONE;       // Page sliding out, if any
+  bool swapped = true;              // Shown page needs a full copy
+  bool rotating = PAGE_ROTATE;
+  bool sliding = PAGE_SLIDE;
+  steady_clock::time_point nextSwap;
+  steady_clock::time_point slideStart;
+
+  bool isReady(Page *page);
+  void swapTo(uint8_t page, bool slide);
+  void checkRotation(steady_clock::time_point now);
+  void renderPage(Page *page, bool force, bool timed);
+  bool drawSlide(rgb_matrix::Canvas *out, steady_clock::time_point now);
+
+public:
+  bool addPage(Page *page);
+  uint8_t size(void);
+  Page* operator[](uint8_t);
+
+  void render(rgb_matrix::Canvas *out, bool force);
+  milliseconds nextUpdateIn(void);
+  bool showPage(const char *name);
+  void setRotation(bool);
+  void setSlide(bool);
+};
+
+extern PageManager pageManager;
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef PANEL_H
+#define PANEL_H
+
+#include "smartgirder.h"
+#include "frameexport.h"
+
+#include <canvas.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+
+using std::chrono::microseconds;
+
+#define PANEL_MAX             4
+#define PANEL_STATS_INTERVAL  60s
+
+// Core to pin the render thread of the matrix panel to.  The
+// matrix library runs its refresh thread on the last core.
+#define PANEL_RENDER_CORE     2
+#define PANEL_NO_CORE         -1
+
+// What a panel shows: a layout of widgets, updated from the
+// state store and drawn to the panel's canvas.  Each layout
+// is only drawn from its panel's render thread.
+class PanelLayout
+{
+public:
+  virtual ~PanelLayout() {}
+
+  // Apply any store updates, and draw anything that changed
+  virtual void render() = 0;
+
+  // Time until the layout next needs drawing, if nothing
+  // in the store changes meanwhile
+  virtual milliseconds nextUpdateIn() = 0;
+
+  virtual void logStats() {}
+};
+
+// A display, with its own render thread drawing a layout
+class Panel
+{
+private:
+  const char *name;
+  PanelLayout *layout;
+  rgb_matrix::Canvas *target;
+  FrameExport *exporter = NULL;     // Publishes our frames, if set
+  int core;
+  std::thread thread;
+  std::atomic<bool> running{false};
+  bool drawn = false;
+
+  // Stats, reset after logging
+  uint32_t frames = 0;
+  microseconds totalRender = 0us;
+  microseconds peakRender = 0us;
+
+  void run();
+  void logStats();
+
+public:
+  Panel(const char *name, PanelLayout *layout, rgb_matrix::Canvas *target,
+      int core = PANEL_NO_CORE)
+    : name(name), layout(layout), target(target), core(core) {}
+
+  void setExport(FrameExport *);
+  void start();
+  void stop();
+};
+
+bool addPanel(Panel *panel);
+void startPanels();
+void stopPanels();
+
+#endif
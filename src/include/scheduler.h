@@ -0,0 +1,62 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "smartgirder.h"
+
+#include <stdint.h>
+
+using std::chrono::microseconds;
+
+// Per-frame CPU budget for animations; the Pi Zero gets a
+// smaller budget as it shares a core with the matrix refresh
+#define ANIM_BUDGET_DEFAULT       4000us
+#define ANIM_BUDGET_PIZERO        1500us
+
+// Number of quality levels (0 = full quality)
+#define ANIM_QUALITY_LEVELS       4
+
+// Consecutive frames over (or well under) budget before
+// we step the quality level down (or back up)
+#define ANIM_DEGRADE_FRAMES       10
+#define ANIM_RECOVER_FRAMES       300
+
+
+// Tracks the CPU time spent on animations during each main
+// loop iteration ("frame") and enforces a time budget.
+//
+// Animations declare an estimated per-frame cost (roughly the
+// number of pixels they touch).  We learn how long one unit of
+// cost takes, and defer animation frames that would overrun the
+// budget.  If we stay over budget the quality level is raised,
+// which animations use to lower particle counts and frame rates.
+class AnimationScheduler
+{
+private:
+  microseconds frameBudget = ANIM_BUDGET_DEFAULT;
+  microseconds frameSpent = 0us;
+  float usPerCost = 0.0;
+  bool frameDeferred = false;
+
+  uint8_t level = 0;
+  uint16_t overFrames = 0;
+  uint16_t underFrames = 0;
+
+  // Stats, reset after logging
+  uint32_t frames = 0;
+  uint32_t deferred = 0;
+  microseconds totalSpent = 0us;
+  microseconds peakSpent = 0us;
+
+public:
+  void setFrameBudget(microseconds budget);
+  uint8_t getLevel() { return level; }
+
+  bool admit(uint32_t cost);
+  void record(uint32_t cost, microseconds elapsed);
+  void endFrame();
+  void logStats();
+};
+
+extern AnimationScheduler animScheduler;
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include "smartgirder.h"
+#include "taskpool.h"
+
+// When we started, phases of startup are logged
+// relative to this to track time-to-first-frame
+extern steady_clock::time_point startupTime;
+
+void startupMark(const char *phase);
+void startupPhaseDone(const char *phase, steady_clock::time_point start);
+
+// Run a startup phase on the task pool, logging how long it took
+template<class F>
+auto startupTask(const char *phase, F func) -> std::shared_future<decltype(func())>
+{
+  return taskPool.submit([phase, func]() {
+    auto start = steady_clock::now();
+    struct Done {
+      const char *phase;
+      steady_clock::time_point start;
+      ~Done() { startupPhaseDone(phase, start); }
+    } done{phase, start};
+    return func();
+  });
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "smartgirder.h"
+
+#include <stdint.h>
+#include <atomic>
+
+// Snapshot of the last message received on each topic, kept
+// in a memory-mapped file and replayed at startup so widgets
+// show their last known values before the broker sends any.
+#define STATE_PATH          "/dev/shm/smartgirder.state"
+#define STATE_MAGIC         0x54534753    // "SGST"
+#define STATE_VERSION       1
+#define STATE_MAX_ENTRIES   32
+#define STATE_TOPIC_LEN     64
+#define STATE_PAYLOAD_LEN   256
+#define STATE_SAVE_PERIOD   1s
+
+struct StateEntry
+{
+  char topic[STATE_TOPIC_LEN];
+  char payload[STATE_PAYLOAD_LEN];
+  uint16_t length;
+  int64_t received;                 // Unix time (s)
+};
+
+// The file holds two copies (slots) of the entries, written
+// alternately.  A slot is only used if its checksum matches,
+// so a crash mid-write leaves the previous slot intact.
+struct StateSlot
+{
+  std::atomic<uint32_t> seq;
+  uint32_t count;
+  uint32_t checksum;
+  StateEntry entries[STATE_MAX_ENTRIES];
+};
+
+struct StateFileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entrySize;
+  uint32_t maxEntries;
+  StateSlot slots[2];
+};
+
+// Receive time of the message being handled, used by
+// widgets to track the age of their data.  Per thread, as
+// messages are received and handled on different threads.
+extern thread_local system_clock::time_point messageTime;
+
+bool isRestored(system_clock::time_point received);
+
+bool initState(void);
+void shutdownState(void);
+void recordState(const char *topic, const char *payload, int length);
+void restoreState(void);
+void checkSaveState(void);
+
+#endif
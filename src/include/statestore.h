@@ -0,0 +1,66 @@
+#ifndef STATESTORE_H
+#define STATESTORE_H
+
+#include "smartgirder.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#define STORE_MAX_SLOTS     48
+#define STORE_VALUE_LEN     256     // Longest text a widget shows
+#define STORE_VALUE_WORDS   (STORE_VALUE_LEN / 8)
+
+// The latest value of one item of data (a topic, or a value
+// parsed from one), guarded by a sequence lock.  The writer
+// makes seq odd while it updates the slot; readers copy the
+// slot and retry if seq changed or was odd meanwhile.  The
+// value is stored as atomic words so copies never race.
+struct StoreSlot
+{
+  std::atomic<uint32_t> seq{0};
+  std::atomic<uint32_t> generation{0};    // Store generation when written
+  std::atomic<int64_t> received{0};       // Receive time (system_clock ticks)
+  std::atomic<uint16_t> length{0};
+  std::atomic<uint64_t> value[STORE_VALUE_WORDS] = {};
+};
+
+// Messages are parsed once, on the MQTT thread, into values in
+// the store.  Panel render threads pick up the values that have
+// changed since they last looked, without taking any locks.
+// There must be a single writer.
+class StateStore
+{
+private:
+  StoreSlot slots[STORE_MAX_SLOTS];
+  std::atomic<uint32_t> gen{0};
+
+  // Only used to sleep until there is something new, and
+  // only taken by the writer while a panel is asleep
+  std::mutex wakeMutex;
+  std::condition_variable wake;
+  std::atomic<uint32_t> waiters{0};
+
+public:
+  uint32_t generation() const {
+    return gen.load(std::memory_order_acquire);
+  }
+  uint32_t slotGeneration(uint8_t slot) const {
+    return slots[slot].generation.load(std::memory_order_acquire);
+  }
+
+  void publish(uint8_t slot, const char *value, size_t length,
+      system_clock::time_point received);
+  uint32_t read(uint8_t slot, char *buffer, size_t size,
+      system_clock::time_point *received = NULL);
+  void waitFor(uint32_t seen, milliseconds timeout,
+      const std::atomic<bool> &running);
+  void wakeAll();
+};
+
+extern StateStore stateStore;
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SURFACE_H
+#define SURFACE_H
+
+#include <canvas.h>
+#include <stdint.h>
+
+#include <vector>
+
+
+// An offscreen RGB canvas with per-pixel coverage, used as the
+// retained render target for a widget.  Pixels that have never
+// been drawn (since the last Clear()) are transparent, so the
+// compositor can show whatever is stacked underneath.
+class Surface : public rgb_matrix::Canvas
+{
+private:
+  int sWidth, sHeight;
+  std::vector<uint8_t> pixels;    // RGB, 3 bytes per pixel
+  std::vector<uint8_t> opaque;    // Coverage, 1 byte per pixel
+
+public:
+  Surface(int w, int h);
+
+  // rgb_matrix::Canvas interface
+  int width() const { return sWidth; }
+  int height() const { return sHeight; }
+  void SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
+  void Clear();
+  void Fill(uint8_t r, uint8_t g, uint8_t b);
+  void clearRect(int x, int y, int w, int h);
+
+  bool isOpaque(int x, int y) const {
+    return opaque[y * sWidth + x];
+  }
+  const uint8_t* getPixel(int x, int y) const {
+    return &pixels[3 * (y * sWidth + x)];
+  }
+
+  bool writePPM(const char *path) const;
+};
+
+#endif
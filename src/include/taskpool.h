@@ -0,0 +1,61 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#define TASK_POOL_THREADS   3
+
+// A small pool of worker threads, used to run slow blocking
+// work (eg. file parsing, network connects) at startup
+// without holding up the main loop.  Tasks are run in the
+// order submitted, and their results returned by futures.
+class TaskPool
+{
+private:
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  void worker();
+
+public:
+  ~TaskPool() { stop(); }
+
+  void start(unsigned threads = TASK_POOL_THREADS);
+  void stop();
+
+  // Queue a task, if the pool isn't started it is run
+  // immediately on the calling thread
+  template<class F>
+  auto submit(F func) -> std::shared_future<decltype(func())>
+  {
+    using result = decltype(func());
+    auto task = std::make_shared<std::packaged_task<result()>>(std::move(func));
+    std::shared_future<result> future = task->get_future().share();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!workers.empty() && !stopping) {
+        tasks.push([task]() { (*task)(); });
+        wake.notify_one();
+        return future;
+      }
+    }
+
+    (*task)();
+    return future;
+  }
+};
+
+extern TaskPool taskPool;
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef TERMINAL_H
+#define TERMINAL_H
+
+#include <canvas.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Each terminal cell shows two pixels, one above the other:
+// an upper half block in the top pixel's (foreground) color,
+// over the bottom pixel's (background) color
+#define TERMINAL_HALF_BLOCK   "▀"
+
+#define TERMINAL_ENTER        "\033[?1049h\033[?25l\033[2J"
+#define TERMINAL_LEAVE        "\033[0m\033[?25h\033[?1049l"
+#define TERMINAL_RESET        "\033[0m"
+
+// A canvas shown in a truecolor terminal, on stdout.  Frames
+// are drawn to memory, and each flush() only writes the cells
+// that changed since the last, with a color escape only when
+// the color differs from the previous cell written.
+class TerminalCanvas : public rgb_matrix::Canvas
+{
+private:
+  int tWidth, tHeight;
+  std::vector<uint8_t> pixels;      // RGB, the frame being drawn
+  std::vector<uint8_t> shown;       // RGB, as last written
+  std::string out;                  // Escapes for a flush
+  bool open = false;
+
+  void write();
+
+public:
+  TerminalCanvas(int w, int h);
+
+  // rgb_matrix::Canvas interface
+  int width() const { return tWidth; }
+  int height() const { return tHeight; }
+  void SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
+  void Clear();
+  void Fill(uint8_t r, uint8_t g, uint8_t b);
+
+  void flush();
+  void close();
+};
+
+#endif
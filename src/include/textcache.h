@@ -0,0 +1,59 @@
+#ifndef TEXTCACHE_H
+#define TEXTCACHE_H
+
+#include "font.h"
+#include "surface.h"
+
+#include <graphics.h>
+#include <stdint.h>
+
+#include <string>
+
+#define TEXT_CACHE_ENTRIES      4
+
+// Padding around text in a raster, glyphs may be shifted
+// left (vGlyphOffset) or extend above/below the font height
+#define TEXT_RASTER_PAD_X       2
+#define TEXT_RASTER_PAD_Y       2
+#define TEXT_RASTER_DESCENT     3
+
+
+// A run of text, laid out and rasterized once
+struct TextRun
+{
+  std::string text;
+  GirderFont *font = NULL;
+  Color color;
+  uint8_t align = 0;
+  bool vWidth = false;
+
+  uint16_t renderLen = 0;         // Measured width, as textRenderLength()
+  Surface *raster = NULL;         // Pre-rendered text, including padding
+  uint32_t lastUsed = 0;
+
+  bool matches(const char *t, GirderFont *f, Color c,
+      uint8_t a, bool v);
+  void rasterize(const char *t, GirderFont *f, Color c,
+      uint8_t a, bool v);
+  void blit(rgb_matrix::Canvas *target, int x, int y);
+  void blit(rgb_matrix::Canvas *target, int x, int y,
+      int srcX, int width);
+  void erase(rgb_matrix::Canvas *target, int x, int y);
+};
+
+// Small LRU cache of rasterized text runs, keyed by
+// (string, font, color, alignment).  An unchanged label
+// re-renders as a single blit of its raster.
+class TextCache
+{
+private:
+  TextRun runs[TEXT_CACHE_ENTRIES];
+  uint32_t useCount = 0;
+
+public:
+  ~TextCache();
+  TextRun* lookup(const char *text, GirderFont *font, Color color,
+      uint8_t align, bool vWidth);
+};
+
+#endif
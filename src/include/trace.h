@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+// Span tracing, dumped as Chrome trace JSON (chrome://tracing
+// or ui.perfetto.dev).  Spans are recorded into a ring buffer
+// per thread, so the most recent events are kept.
+#define TRACE_BUFFER_EVENTS     8192        // Per thread, power of 2
+#define TRACE_PATH              "/dev/shm/smartgirder-trace.json"
+#define TRACE_DEFAULT_ENABLED   true
+
+struct TraceEvent
+{
+  const char *name;       // Static strings only, stored by pointer
+  const char *arg;        // Optional, eg. widget name
+  uint64_t start;         // ns, steady clock
+  uint32_t duration;      // ns
+};
+
+extern std::atomic<bool> traceEnabled;
+
+void setTraceEnabled(bool);
+void requestTraceDump(void);
+void checkTraceDump(void);
+bool traceDump(const char *path = TRACE_PATH);
+void traceRecord(const char *name, const char *arg, uint64_t start, uint64_t end);
+
+inline uint64_t traceNow()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Records the time from construction to the end of
+// scope, if tracing was enabled at the start of the span
+class TraceSpan
+{
+private:
+  const char *name = NULL;
+  const char *arg = NULL;
+  uint64_t start = 0;
+
+public:
+  TraceSpan(const char *spanName, const char *spanArg = NULL)
+  {
+    if (traceEnabled.load(std::memory_order_relaxed)) {
+      name = spanName;
+      arg = spanArg;
+      start = traceNow();
+    }
+  }
+
+  ~TraceSpan()
+  {
+    if (name)
+      traceRecord(name, arg, start, traceNow());
+  }
+};
+
+#define __TRACE_CONCAT(a, b)      a##b
+#define __TRACE_VAR(line)         __TRACE_CONCAT(__traceSpan, line)
+#define TRACE_SPAN(name)          TraceSpan __TRACE_VAR(__LINE__)(name)
+#define TRACE_SPAN_ARG(name, arg) TraceSpan __TRACE_VAR(__LINE__)(name, arg)
+
+#endif
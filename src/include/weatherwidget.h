@@ -2,12 +2,13 @@
 #define WEATHERWIDGET_H
 
 #include "dynamicwidget.h"
+#include "scheduler.h"
 #include "datetime.h"
 #include "weather.h"
 #include "logger.h"
+#include "trace.h"
+#include "iconcache.h"
 
-#include <png++/png.hpp>
-#include <sys/stat.h>
 #include <string.h>
 #include <time.h>
 
@@ -26,6 +27,10 @@ typedef std::uniform_int_distribution<> distrib;
 uint16_t imgIndex(uint8_t x, uint8_t y, uint8_t width);
 Color getRandomColor(vector<string>);
 
+// Fixed seed for animation randomness, so tools can render
+// reproducible frames.  Zero (the default) seeds randomly.
+extern uint32_t animationSeed;
+
 
 /*
  weather conditions/types:
@@ -51,6 +56,32 @@ struct Bounds {
     xTop(xT), yTop(yT), xBot(xB), yBot(yB) {}
 };
 
+// Set of pixels changed in an image buffer during an
+// animation frame, stored as pixel (not byte) indexes.
+// A bitmap prevents duplicates when a pixel is both
+// cleared and redrawn within the same frame.
+struct DirtyPixels {
+  vector<uint16_t> pixels;
+  vector<bool> marked;
+
+  void resize(uint16_t count) {
+    marked.assign(count, false);
+    pixels.clear();
+    pixels.reserve(count);
+  }
+  void mark(uint16_t idx) {
+    if (idx < marked.size() && !marked[idx]) {
+      marked[idx] = true;
+      pixels.push_back(idx);
+    }
+  }
+  void clear() {
+    for (auto idx : pixels)
+      marked[idx] = false;
+    pixels.clear();
+  }
+};
+
 // Class to store configuration for an animation:
 //   Image parameters/buffers, animation bounds
 //   and weather type.
@@ -62,14 +93,22 @@ public:
   uint8_t imgWidth;
   Bounds bounds;
   weatherType weather;
+  DirtyPixels *dirty = NULL;
 
   int8_t (*pixelGenX)(int8_t);
   int8_t (*pixelGenY)(int8_t);
 
   AnimatedConfig() {};
   AnimatedConfig(uint8_t *i, const uint8_t *o,
-    uint8_t w, weatherType wthr) : image(i), origImage(o),
-    imgWidth(w), weather(wthr) {};
+    uint8_t w, weatherType wthr, DirtyPixels *d = NULL) :
+    image(i), origImage(o), imgWidth(w), weather(wthr),
+    dirty(d) {};
+
+  // Flag a pixel (by byte index into our image) as changed
+  void markDirty(uint16_t idx) {
+    if (dirty)
+      dirty->mark(idx / 3);
+  }
 
   void setBounds(const Bounds &b) { bounds = b; }
   void setPixelGen(int8_t (*x)(int8_t), int8_t (*y)(int8_t)) {
@@ -167,8 +206,10 @@ public:
   void render() {
     for (vector<Pixel>::iterator pxl = pixels.begin();
       pxl != pixels.end(); pxl++) {
-        if (pxl->checkBounds(bounds))
+        if (pxl->checkBounds(bounds)) {
           pxl->render(image, imgWidth);
+          markDirty(pxl->index(imgWidth));
+        }
     }
   }
 
@@ -183,6 +224,7 @@ public:
     {
       auto index = pxl->index(imgWidth);
       memcpy(image+index, origImage+index, sizeof(uint8_t)*3);
+      markDirty(index);
     }
 
     // Check bounds, move and render at new location
@@ -200,6 +242,7 @@ public:
 
       if (pxl->checkBounds(bounds)) {
         pxl->render(image, imgWidth);
+        markDirty(pxl->index(imgWidth));
       }
 
       pxl++;
@@ -226,6 +269,8 @@ private:
 
 protected:
   uint8_t dropId = 0;
+  uint8_t targetDrops = 0;
+  uint16_t dropPixels = 0;
   AnimatedConfig conf;
 
 public:
@@ -235,9 +280,21 @@ public:
   {
     conf = animConf;
     drops.clear();
+    dropPixels = 0;
     init = true;
   }
 
+  // Set the number of drops to maintain; if lowered, drops
+  // are not replaced as they fall out of our bounds
+  void setTargetDrops(uint8_t count) {
+    targetDrops = count;
+  }
+
+  // Number of drop pixels moved in the last update
+  uint16_t getDropPixels() {
+    return dropPixels;
+  }
+
   // Create a drop at a random location within our bounds
   // TODO: Add some logic to prevent "clustering" (eg: ensure
   // semi-uniform distribution, maybe with a mandatory spacing)
@@ -264,7 +321,9 @@ public:
     //     }
     //   }
     // }
-    drops.push_back(*makeDrop(inCloud));
+    GenericDrop *drop = makeDrop(inCloud);
+    drops.push_back(*drop);
+    delete drop;
   }
 
   void updateDropAnimation()
@@ -276,24 +335,24 @@ public:
     }
 
     // Iterate through our drops
-    uint8_t removedDrops = 0;
+    dropPixels = 0;
     for (vector<GenericDrop>::iterator drop = drops.begin();
       drop != drops.end();)
     {
       // Move the drop, removing pixels that
       // lie outside our bounds
       drop->move();
+      dropPixels += drop->size();
 
       // If no pixels are left in our drop, then remove it
       if (drop->size() == 0)
-      {
         drop = drops.erase(drop);
-        removedDrops++;
-      }
       else drop++;
     }
 
-    for (auto i=0; i<removedDrops; i++, addDrop());
+    // Replace drops that have left our bounds
+    while (drops.size() < targetDrops)
+      addDrop();
   }
 };
 
@@ -301,10 +360,23 @@ class AnimationBase {
 private:
   bool aInit = false;
 
+protected:
+  uint8_t quality = 0;
+
+  // Scale a particle count and frame period
+  // for our current quality level
+  uint8_t scaleCount(uint8_t count) {
+    return count * (ANIM_QUALITY_LEVELS - quality) / ANIM_QUALITY_LEVELS;
+  }
+  milliseconds scalePeriod(milliseconds period) {
+    return period * (2 + quality) / 2;
+  }
+
 public:
   const uint16_t DEFAULT_INTERVAL_MS = 1000;
   bool isInit() { return aInit; }
   void setInit(bool init) { aInit = init; }
+  uint8_t getQuality() { return quality; }
 
   //
   // Functions overridden in our derived classes
@@ -320,8 +392,17 @@ public:
     return milliseconds(DEFAULT_INTERVAL_MS);
   }
 
-  // Render next animation frame
-  virtual void updateAnimation() {}
+  // Estimated work for a single frame, used by the
+  // animation scheduler to enforce the frame budget
+  virtual uint32_t getFrameCost() { return 0; }
+
+  // Set the degradation level (0 = full quality), higher
+  // levels should reduce particle counts and frame rates
+  virtual void setQuality(uint8_t level) { quality = level; }
+
+  // Render next animation frame, returning the set of
+  // changed pixels (or NULL if a full redraw is needed)
+  virtual const DirtyPixels* updateAnimation() { return NULL; }
 };
 
 class SunAnimation : public AnimationBase
@@ -367,7 +448,7 @@ public:
     dropDistYCloud = new distrib(bounds.yTop - 5, bounds.yTop);
     dropSize = new distrib(2, 3);
     boundWidth = bounds.xBot - bounds.xTop;
-    columnDropHold = vector<uint8_t>(bounds.xBot - bounds.xTop, 0);
+    columnDropHold = vector<uint8_t>(boundWidth + 1, 0);
   }
 
   // Functions to generate pixel coordinates from an index
@@ -426,24 +507,38 @@ public:
     animConf.setBounds(bounds);
     animConf.setPixelGen(&pixelGenX, &pixelGenY);
     configDrop(animConf);
+    std::fill(columnDropHold.begin(), columnDropHold.end(), 0);
+    if (animationSeed)
+      gen.seed(animationSeed);
 
     // Create some drops
-    for (auto i=0; i<numDrops; i++) {
+    setTargetDrops(scaleCount(numDrops));
+    for (auto i=0; i<targetDrops; i++) {
       addDrop(false);
     }
   }
 
   // How frequently we update our animation
   milliseconds getUpdatePeriod() {
-    return milliseconds(imageUpdatePeriodMs);
+    return scalePeriod(imageUpdatePeriodMs);
   }
 
-  void updateAnimation()
+  uint32_t getFrameCost() {
+    return getDropPixels();
+  }
+
+  void setQuality(uint8_t level) {
+    quality = level;
+    setTargetDrops(scaleCount(numDrops));
+  }
+
+  const DirtyPixels* updateAnimation()
   {
     updateDropAnimation();
     for (auto i=0; i<columnDropHold.size(); i++) {
       columnDropHold[i] = std::max(columnDropHold[i] - 1, 0);
     }
+    return conf.dirty;
   }
 };
 
@@ -459,8 +554,8 @@ public:
   std::random_device rd;
   std::mt19937 gen;
   distrib *dropDistX, *dropDistY, *dropDistYCloud, *dropSize;
-  uint8_t *lImage;
-  uint32_t lWidth, lHeight;
+  const uint8_t *lImage = NULL;
+  uint32_t lWidth = 0, lHeight = 0;
 
   LightningRainAnimation()
   {
@@ -468,40 +563,6 @@ public:
     dropDistY = new distrib(bounds.yTop, bounds.yBot);
     dropDistYCloud = new distrib(bounds.yTop - 5, bounds.yTop);
     dropSize = new distrib(2, 3);
-
-    // Load lightning bolt image into buffer
-    png::image<png::rgb_pixel> imagePNG;
-    struct stat buffer;
-
-    if (stat(ICON_LIGHTNING_BOLT, &buffer) == 0) {
-      imagePNG.read(ICON_LIGHTNING_BOLT);
-    } else {
-      _error("unable to find storm image %s", ICON_LIGHTNING_BOLT);
-      return;
-    }
-
-    // _log(ICON_LIGHTNING_BOLT);
-    lWidth = imagePNG.get_width();
-    lHeight = imagePNG.get_height();
-    // printf("width: %d, height: %d\n", lWidth, lHeight);
-    lImage = (uint8_t *)malloc(lWidth * lHeight * 3 * sizeof(uint8_t));
-    if (lImage == NULL) {
-      _error("unable to allocate buffer for icon, aborting");
-      return;
-    }
-    // _log(__METHOD__);
-    // _log("width: %d, height: %d", lWidth, lHeight);
-    // _log("width: %d, height: %d", imagePNG.get_width(), imagePNG.get_height());
-
-    uint16_t idx = 0;
-    for (uint16_t y = 0; y < lHeight; y++) {
-      for (uint16_t x = 0; x < lWidth; x++) {
-        png::rgb_pixel pixel = imagePNG.get_pixel(x, y);
-        lImage[idx++] = pixel.red;
-        lImage[idx++] = pixel.green;
-        lImage[idx++] = pixel.blue;
-      }
-    }
   }
 
   // Functions to generate pixel coordinates from an index
@@ -528,16 +589,42 @@ public:
     animConf.setBounds(bounds);
     animConf.setPixelGen(&pixelGenX, &pixelGenY);
     configDrop(animConf);
+    if (animationSeed)
+      gen.seed(animationSeed);
+
+    // Lightning bolt image, decoded (or preloaded) once
+    if (lImage == NULL) {
+      if (auto bolt = loadIcon(ICON_LIGHTNING_BOLT)) {
+        lImage = bolt->pixels;
+        lWidth = bolt->width;
+        lHeight = bolt->height;
+      } else {
+        _error("unable to find storm image %s", ICON_LIGHTNING_BOLT);
+      }
+    }
 
     // Create some drops
-    for (auto i=0; i<numDrops; i++) {
+    setTargetDrops(scaleCount(numDrops));
+    for (auto i=0; i<targetDrops; i++) {
       addDrop(false);
     }
   }
 
   // How frequently we update our animation
   milliseconds getUpdatePeriod() {
-    return milliseconds(imageUpdatePeriodMs);
+    return scalePeriod(imageUpdatePeriodMs);
+  }
+
+  // Lightning frames also walk the full bolt image
+  uint32_t getFrameCost() {
+    if (frame % 15 < 4)
+      return getDropPixels() + lWidth * lHeight;
+    return getDropPixels();
+  }
+
+  void setQuality(uint8_t level) {
+    quality = level;
+    setTargetDrops(scaleCount(numDrops));
   }
 
   void updateBackground(bool drawLightning)
@@ -565,11 +652,12 @@ public:
           memset(image+idx, 0, sizeof(uint8_t)*3);
           memset(origImage+idx, 0, sizeof(uint8_t)*3);
         }
+        conf.markDirty(idx);
       }
     }
   }
 
-  void updateAnimation()
+  const DirtyPixels* updateAnimation()
   {
     frame++;
     updateDropAnimation();
@@ -582,6 +670,8 @@ public:
       updateBackground(true);
     if (frame % 15 == 3)
       updateBackground(false);
+
+    return conf.dirty;
   }
 };
 
@@ -609,18 +699,29 @@ public:
     configDrop(animConf);
 
     // Create some drops
-    for (auto i=0; i<numDrops; i++) {
+    setTargetDrops(scaleCount(numDrops));
+    for (auto i=0; i<targetDrops; i++) {
       addDrop();
     }
   }
 
   // How frequently we update our animation
   milliseconds getUpdatePeriod() {
-    return milliseconds(imageUpdatePeriodMs);
+    return scalePeriod(imageUpdatePeriodMs);
+  }
+
+  uint32_t getFrameCost() {
+    return getDropPixels();
+  }
+
+  void setQuality(uint8_t level) {
+    quality = level;
+    setTargetDrops(scaleCount(numDrops));
   }
 
-  void updateAnimation() {
+  const DirtyPixels* updateAnimation() {
     updateDropAnimation();
+    return conf.dirty;
   }
 };
 
@@ -642,6 +743,7 @@ private:
   // General configuration
   weatherType weather;
   AnimatedConfig aConf;
+  DirtyPixels aDirty;
   const uint8_t *iImageOrig;
 
   // Animation timing
@@ -710,13 +812,15 @@ public:
     memcpy((void *)iImageOrig, iImage, size);
 
     // iImage/iWidth set in DashboardWidget::updateIcon() above
+    aDirty.resize(iWidth * iHeight);
     aConf = {
-        (uint8_t *)iImage, iImageOrig, iWidth, weather
+        (uint8_t *)iImage, iImageOrig, iWidth, weather, &aDirty
     };
 
     // Find our animation and if present, configure
     if (auto anim = getAnimation(weather))
     {
+      anim->setQuality(animScheduler.getLevel());
       anim->config(aConf);
       setImageUpdatePeriod(
           anim->getUpdatePeriod()
@@ -739,15 +843,36 @@ public:
     // for a brief time upon startup. Animation config
     // update is only triggered after a weather state
     // MQTT message
-
-    // TODO: Check to see if animation is actually active/
-    // visible (eg: background weather forecast widget)
+    //
+    // Hidden/occluded widgets are not ticked by the
+    // WidgetManager, so we only animate while visible
     auto anim = getAnimation(weather);
     if (!anim || !anim->isInit())
         return;
 
-    anim->updateAnimation();
-    render();
+    TRACE_SPAN_ARG("animation", name);
+
+    // Pick up any change in quality level from the scheduler
+    if (anim->getQuality() != animScheduler.getLevel()) {
+      anim->setQuality(animScheduler.getLevel());
+      setImageUpdatePeriod(anim->getUpdatePeriod());
+    }
+
+    // Skip this frame if it would exceed our frame budget
+    auto cost = anim->getFrameCost();
+    if (!animScheduler.admit(cost))
+      return;
+
+    // Push only the pixels changed by the animation, falling
+    // back to a full render if the animation doesn't track them
+    auto start = steady_clock::now();
+    aDirty.clear();
+    if (auto dirty = anim->updateAnimation())
+      renderIconPixels(dirty->pixels);
+    else
+      render();
+    animScheduler.record(cost, std::chrono::duration_cast<microseconds>(
+        steady_clock::now() - start));
   }
 };
 
@@ -3,12 +3,15 @@
 
 #include "smartgirder.h"
 #include "display.h"
+#include "surface.h"
+#include "textcache.h"
+#include "history.h"
 
-#include <png++/png.hpp>
 #include <graphics.h>
 #include <time.h>
 
 #include <string>
+#include <vector>
 
 
 #define WIDGET_NAME_LEN         32
@@ -26,22 +29,40 @@
 
 #define WIDGET_ICON_TEXT_GAP    4
 
+// Extra rows below the widget bounds in its surface, to
+// hold glyph descenders that extend past the widget
+#define WIDGET_SURFACE_MARGIN   3
+
+// Marquee scrolling for text wider than the widget:
+// time per 1px step (40 fps), hold time at the start
+// of each pass and the gap (px) before the text repeats
+#define WIDGET_SCROLL_PERIOD    25ms
+#define WIDGET_SCROLL_HOLD      2s
+#define WIDGET_SCROLL_GAP       24
+
+// Longest we wait between checks if nothing is scheduled
+#define WIDGET_IDLE_PERIOD      1s
+
 #define ICON_SZ                 800
 #define ICON_SZ_BYTES           ICON_SZ * sizeof(uint16_t)
 
 #define TEXT_RENDER_SIG         (uint8_t x, uint8_t y, Color color,\
-    const char *text, GirderFont *font, bool vWidth)
+    const char *text, GirderFont *font, bool vWidth,\
+    rgb_matrix::Canvas *target)
 
 
 using rgb_matrix::Color;
 
 char* tempIntHelper(char *);
 char* tempC2FHelper(char *);
+char* tempDegreeHelper(char *);
 char* floatStrLen(char *);
 const char* weatherIconHelper(char *);
+void color565_2RGB(uint16_t value, uint8_t *rgb);
 
 extern Color colorText;
 
+class WidgetManager;
 
 class DashboardWidget
 {
@@ -57,7 +78,12 @@ protected:
   char name[WIDGET_NAME_LEN+1];   // Name of widget
   bool active = true;
   bool tempActive = false;
+  bool visible = true;            // Set by WidgetManager
+  bool dirty = false;             // Needs rendering on the next frame
+  bool stale = false;             // Data is restored, drawn dimmed
+  system_clock::time_point dataTime;  // When our data was received
   bool debug = false;
+  uint8_t zOrder = 0;             // Higher is drawn on top
 
   uint8_t widgetX = 0;
   uint8_t widgetY = 0;
@@ -88,6 +114,20 @@ protected:
   float tAlertLevel;
   rgb_matrix::Color tAlertColor;
 
+  // Rasterized text runs, reused while the text is unchanged
+  TextCache tCache;
+
+  // Marquee scrolling state
+  bool tScroll = false;           // Scrolling enabled
+  bool tScrolling = false;        // Text currently too long, scrolling
+  bool tScrollReset = true;
+  TextRun *tScrollRun = NULL;
+  uint8_t tScrollX = 0;           // Start of the visible text window
+  uint16_t tScrollPos = 0;        // Current position in the text (px)
+  uint16_t tScrollCount = 0;      // Completed passes of the text
+  milliseconds tScrollPeriod = WIDGET_SCROLL_PERIOD;
+  steady_clock::time_point tNextScrollTime;
+
   // Icon config/data
   bool iInit = false;
   int8_t iX = 0;
@@ -104,12 +144,21 @@ protected:
   // Track when active toggles
   time_point<system_clock> resetActiveTime;
 
+  // Past values, kept when tracking our history
+  SensorHistory *history = NULL;
+
+  // Retained render target, composited by our manager
+  Surface *surface = NULL;
+  WidgetManager *manager = NULL;
+
   /*** FUNCTIONS ***/
   // Getters/setters/helpers
   void      _logName();
   uint8_t   _getWidth();
   uint8_t   _getHeight();
   uint16_t  _getIconSize();
+  void      _allocSurface();
+  void      recordHistory(const char *);
 
 public:
   // Init / config
@@ -117,9 +166,20 @@ public:
 
   void setDebug(bool);
   void setActive(bool);
+  bool isActive();
+  void setZOrder(uint8_t);
+  uint8_t getZOrder();
+  bool isVisible();
+  virtual void setVisible(bool);
+  bool covers(DashboardWidget *other);
   void setOrigin(uint8_t x, uint8_t y);
   void setSize(widgetSizeType);
   void setBounds(uint8_t width, uint8_t height);
+  void setManager(WidgetManager *);
+  Surface* getSurface();
+  uint8_t getX();
+  uint8_t getY();
+  bool contains(int x, int y);
 
   // Functions - Text
   char* getText();
@@ -137,10 +197,15 @@ public:
   void setCustomTextRender(void (render)TEXT_RENDER_SIG);
   void setVariableWidth(bool);
   void setAlertLevel(float, rgb_matrix::Color);
+  void setScrollText(bool);
+  void setScrollPeriod(milliseconds);
+  bool scrollPending();
   void setTextColor(rgb_matrix::Color);
   void updateText(char *text, bool brighten = true);
   void updateText(char *text, char*(helperFunc)(char*),
       bool brighten = true);
+  void trackHistory();
+  SensorHistory* getHistory();
 
   // Functions - Icon
   void setIconOrigin(uint8_t x, uint8_t y);
@@ -155,12 +220,20 @@ public:
   void updateIcon(std::string data);
 
   // Functions - Rendering
-  void clear(bool = false);
+  void clear();
   void render();
+  void markDirty();
+  bool isDirty();
+  bool hasData();
+  void checkStale();
   void clearIcon();
+  void present(int x = 0, int y = 0, int w = -1, int h = -1);
 protected:
   virtual int renderText();
+  void renderScrollText();
+  void checkScrollUpdate();
   void renderIcon();
+  void renderIconPixels(const std::vector<uint16_t>& pixels);
 
 public:
   // Functions - Brightness adjustments
@@ -175,6 +248,7 @@ public:
 
   // Functions - Generic periodic updates
   virtual void checkUpdate();
+  virtual milliseconds nextUpdateIn();
 };
 
 #endif
\ No newline at end of file
@@ -13,6 +13,17 @@ class WidgetManager
 private:
   uint8_t numWidgets = 0;
   vector<DashboardWidget *> widgets;
+  vector<DashboardWidget *> layers;   // Widgets sorted by z-order
+
+  // Active state of each widget (one bit per widget) as of
+  // the last visibility update, to detect changes cheaply
+  uint32_t activeMask = 0;
+  bool visibilityInit = false;
+
+  // Where our widgets are composited, or the display if unset
+  rgb_matrix::Canvas *target = NULL;
+
+  void updateVisibility(void);
 
 public:
   WidgetManager();
@@ -20,9 +31,15 @@ public:
   uint16_t size(void);
 
   void addWidget(DashboardWidget *widget);
+  void setTarget(rgb_matrix::Canvas *);
+  bool hasData(void);
   void checkUpdate(void);
+  milliseconds nextUpdateIn(void);
+  bool isOccluded(DashboardWidget *widget);
+  void composite(int x, int y, int w, int h);
   void checkResetUpdateBrightness(bool force);
   void displayDashboard(void);
+  void renderDirty(void);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,278 @@
+#include "json.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Position in the document being scanned, with the path to it
+struct JsonScan
+{
+  const char *pos, *end;
+  uint8_t depth = 0;
+  bool done = false;
+
+  // Object key or array index at each level
+  struct {
+    const char *key;
+    size_t keyLength;
+    long index;
+  } frames[JSON_MAX_DEPTH];
+
+  const char *const *paths;
+  JsonValue *values;
+  uint8_t count;
+  uint8_t found = 0;
+};
+
+static bool scanValue(JsonScan &s);
+
+static void skipSpace(JsonScan &s)
+{
+  while (s.pos < s.end && (*s.pos == ' ' || *s.pos == '\t' ||
+      *s.pos == '\n' || *s.pos == '\r'))
+    s.pos++;
+}
+
+// Check a path against where we are in the document
+static bool pathMatches(const char *path, const JsonScan &s)
+{
+  const char *p = path;
+
+  for (uint8_t d = 0; d < s.depth; d++)
+  {
+    if (s.frames[d].index < 0) {
+      if (d > 0 && *p++ != '.')
+        return false;
+      size_t length = strcspn(p, ".[");
+      if (length != s.frames[d].keyLength || memcmp(p, s.frames[d].key, length) != 0)
+        return false;
+      p += length;
+    } else {
+      if (*p != '[')
+        return false;
+      char *after;
+      long index = strtol(p + 1, &after, 10);
+      if (*after != ']' || index != s.frames[d].index)
+        return false;
+      p = after + 1;
+    }
+  }
+
+  return *p == '\0';
+}
+
+// Find a path we're looking for at our position, if any
+static int8_t findPath(const JsonScan &s)
+{
+  if (s.depth > JSON_MAX_DEPTH)
+    return -1;
+
+  for (uint8_t i = 0; i < s.count; i++) {
+    if (s.values[i].type == JSON_NONE && pathMatches(s.paths[i], s))
+      return i;
+  }
+  return -1;
+}
+
+// Scan over a string, leaving its contents (without quotes)
+static bool scanString(JsonScan &s, const char **start, size_t *length)
+{
+  if (s.pos >= s.end || *s.pos != '"')
+    return false;
+
+  *start = ++s.pos;
+  while (s.pos < s.end && *s.pos != '"') {
+    if (*s.pos == '\\')
+      s.pos++;
+    s.pos++;
+  }
+  if (s.pos >= s.end)
+    return false;
+
+  *length = s.pos++ - *start;
+  return true;
+}
+
+static bool scanObject(JsonScan &s)
+{
+  s.pos++;
+  skipSpace(s);
+  if (s.pos < s.end && *s.pos == '}') {
+    s.pos++;
+    return true;
+  }
+
+  while (s.pos < s.end)
+  {
+    const char *key;
+    size_t keyLength;
+
+    skipSpace(s);
+    if (!scanString(s, &key, &keyLength))
+      return false;
+    skipSpace(s);
+    if (s.pos >= s.end || *s.pos++ != ':')
+      return false;
+
+    if (s.depth < JSON_MAX_DEPTH)
+      s.frames[s.depth] = {key, keyLength, -1};
+    s.depth++;
+    bool valid = scanValue(s);
+    s.depth--;
+    if (!valid || s.done)
+      return valid;
+
+    skipSpace(s);
+    if (s.pos >= s.end)
+      return false;
+    if (*s.pos == '}') {
+      s.pos++;
+      return true;
+    }
+    if (*s.pos++ != ',')
+      return false;
+  }
+  return false;
+}
+
+static bool scanArray(JsonScan &s)
+{
+  s.pos++;
+  skipSpace(s);
+  if (s.pos < s.end && *s.pos == ']') {
+    s.pos++;
+    return true;
+  }
+
+  for (long index = 0; s.pos < s.end; index++)
+  {
+    if (s.depth < JSON_MAX_DEPTH)
+      s.frames[s.depth] = {NULL, 0, index};
+    s.depth++;
+    bool valid = scanValue(s);
+    s.depth--;
+    if (!valid || s.done)
+      return valid;
+
+    skipSpace(s);
+    if (s.pos >= s.end)
+      return false;
+    if (*s.pos == ']') {
+      s.pos++;
+      return true;
+    }
+    if (*s.pos++ != ',')
+      return false;
+  }
+  return false;
+}
+
+// Scan over a value, recording it if it's one we're looking for
+static bool scanValue(JsonScan &s)
+{
+  skipSpace(s);
+  if (s.pos >= s.end || s.depth > JSON_MAX_NESTING)
+    return false;
+
+  int8_t match = findPath(s);
+  JsonValue value;
+  value.start = s.pos;
+
+  switch (*s.pos)
+  {
+  case '{':
+    value.type = JSON_OBJECT;
+    if (!scanObject(s))
+      return false;
+    break;
+  case '[':
+    value.type = JSON_ARRAY;
+    if (!scanArray(s))
+      return false;
+    break;
+  case '"':
+    value.type = JSON_STRING;
+    if (!scanString(s, &value.start, &value.length))
+      return false;
+    break;
+  default:
+    // Literals and numbers run until a delimiter
+    while (s.pos < s.end && !strchr(",}] \t\r\n", *s.pos))
+      s.pos++;
+    if (s.pos == value.start)
+      return false;
+    if (*value.start == 'n')
+      value.type = JSON_NULL;
+    else if (*value.start == 't' || *value.start == 'f')
+      value.type = JSON_BOOL;
+    else
+      value.type = JSON_NUMBER;
+  }
+
+  // A value we found inside this one may have finished our scan
+  if (s.done)
+    return true;
+
+  if (match >= 0)
+  {
+    if (value.type != JSON_STRING)
+      value.length = s.pos - value.start;
+    s.values[match] = value;
+    s.done = (++s.found == s.count);
+  }
+  return true;
+}
+
+uint8_t jsonExtract(const char *json, size_t length, const char *const *paths,
+  JsonValue *values, uint8_t count)
+{
+  JsonScan s;
+  s.pos = json;
+  s.end = json + length;
+  s.paths = paths;
+  s.values = values;
+  s.count = count;
+
+  for (uint8_t i = 0; i < count; i++)
+    values[i] = JsonValue();
+
+  scanValue(s);
+  return s.found;
+}
+
+size_t jsonValueText(const JsonValue &value, char *buffer, size_t size)
+{
+  size_t length = 0;
+
+  if (size == 0)
+    return 0;
+
+  for (size_t i = 0; i < value.length && length < size - 1; i++)
+  {
+    char c = value.start[i];
+    if (value.type == JSON_STRING && c == '\\' && i + 1 < value.length)
+    {
+      c = value.start[++i];
+      switch (c) {
+      case 'n': c = '\n'; break;
+      case 't': c = '\t'; break;
+      case 'r': c = '\r'; break;
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'u':
+        // Only Latin-1 characters can be drawn by our fonts
+        if (i + 4 < value.length) {
+          char hex[5] = {value.start[i+1], value.start[i+2],
+            value.start[i+3], value.start[i+4], '\0'};
+          long code = strtol(hex, NULL, 16);
+          c = (code < 0x100) ? (char) code : '?';
+          i += 4;
+        }
+        break;
+      }
+    }
+    buffer[length++] = c;
+  }
+
+  buffer[length] = '\0';
+  return length;
+}
@@ -1,103 +1,397 @@
 #include "logger.h"
-#include "datetime.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
-FILE *logger;
+#include <thread>
+#include <algorithm>
+#include <cerrno>
 
-void initLogger()
+// Mapped circular log file
+static int logFd = -1;
+static LogFileHeader *logHeader = NULL;
+static char *logData = NULL;
+static size_t logMapSize = 0;
+
+// Lines are also written to stdout, unless it is in use
+// (eg. by the terminal display)
+static std::atomic<bool> logConsole{true};
+
+// Header printed for each log level
+static const char *logHeaders[] = {
+  TERM_RED "[err]  ",
+  TERM_YELLOW "[warn] ",
+  TERM_BLUE "[info] ",
+  "[dbg]  ",
+};
+
+// Ring buffer of queued messages (bounded MPSC queue).  Each
+// slot sequence number tells producers and the writer whether
+// the slot is free for the current lap or holds a message.
+struct LogSlot
+{
+  std::atomic<size_t> seq;
+  uint8_t level;
+  time_t time;
+  char text[LOG_MSG_LEN];
+};
+
+static LogSlot logRing[LOG_RING_SLOTS];
+static std::atomic<size_t> enqueuePos{0};
+static size_t dequeuePos = 0;             // Writer thread only
+static std::atomic<uint32_t> droppedCount{0};
+
+// Writer thread state, producers only wake the writer if it is waiting
+static std::thread writerThread;
+static std::atomic<bool> writerRunning{false};
+static std::atomic<bool> writerWaiting{false};
+static std::atomic<uint32_t> writerWake{0};
+
+// Timestamp string, only reformatted when the second changes
+static time_t cachedTime = 0;
+static char cachedTimestamp[20];
+
+static const char *logTimestamp(time_t now)
+{
+  if (now != cachedTime)
+  {
+    tm localtm;
+    localtime_r(&now, &localtm);
+    strftime(cachedTimestamp, sizeof(cachedTimestamp),
+        "%Y-%m-%d %H:%M:%S", &localtm);
+    cachedTime = now;
+  }
+  return cachedTimestamp;
+}
+
+// Copy a line into the circular log file, wrapping
+// at the end of the buffer.  head is published after
+// the data is written, for readers.
+static void writeLogFile(const char *line, uint32_t len)
+{
+  uint32_t capacity = logHeader->capacity;
+  uint32_t head = logHeader->head.load(std::memory_order_relaxed);
+  uint32_t offset = head & (capacity - 1);
+
+  if (len > capacity)
+    len = capacity;
+
+  uint32_t first = std::min(len, capacity - offset);
+  memcpy(logData + offset, line, first);
+  memcpy(logData, line + first, len - first);
+
+  if (offset + len >= capacity)
+    logHeader->wrapped.store(1, std::memory_order_relaxed);
+  logHeader->head.store(head + len, std::memory_order_release);
+}
+
+// Write a single formatted line to the console and log file
+static void writeLine(uint8_t level, time_t time, const char *text)
+{
+  char line[LOG_MSG_LEN + 64];
+  int len = snprintf(line, sizeof(line), "%s %s%s%s\n", logTimestamp(time),
+      logHeaders[level], TERM_DEFAULT, text);
+  if (len >= (int) sizeof(line)) {
+    len = sizeof(line) - 1;
+    line[len - 1] = '\n';
+  }
+
+  if (logConsole.load(std::memory_order_relaxed))
+    fwrite(line, 1, len, stdout);
+  if (logHeader)
+    writeLogFile(line, len);
+}
+
+static void flushLines()
+{
+  fflush(stdout);
+}
+
+// Create and map our circular log file, the capacity
+// is rounded down to a power of 2 so head can wrap
+static bool openLogFile(size_t logSize)
+{
+  uint32_t capacity = 4096;
+  while (capacity * 2 <= logSize && capacity < (1u << 30))
+    capacity *= 2;
+
+  logFd = open(LOG_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (logFd < 0)
+    return false;
+
+  logMapSize = sizeof(LogFileHeader) + capacity;
+  if (ftruncate(logFd, logMapSize) != 0) {
+    close(logFd);
+    logFd = -1;
+    return false;
+  }
+
+  void *map = mmap(NULL, logMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, logFd, 0);
+  if (map == MAP_FAILED) {
+    close(logFd);
+    logFd = -1;
+    return false;
+  }
+
+  logHeader = (LogFileHeader *) map;
+  logHeader->magic = LOG_FILE_MAGIC;
+  logHeader->version = LOG_FILE_VERSION;
+  logHeader->headerSize = sizeof(LogFileHeader);
+  logHeader->capacity = capacity;
+  logHeader->head = 0;
+  logHeader->wrapped = 0;
+  logData = (char *) map + sizeof(LogFileHeader);
+
+  return true;
+}
+
+static void closeLogFile()
+{
+  if (logHeader)
+    munmap(logHeader, logMapSize);
+  if (logFd >= 0)
+    close(logFd);
+
+  logHeader = NULL;
+  logData = NULL;
+  logFd = -1;
+}
+
+// Write out all queued messages, returns false if none
+static bool drainRing()
 {
-  if (LOG_TO_FILE) {
-    logger = fopen(LOG_PATH, "w+");
+  bool written = false;
+
+  while (true)
+  {
+    LogSlot *slot = &logRing[dequeuePos & (LOG_RING_SLOTS - 1)];
+    if (slot->seq.load(std::memory_order_acquire) != dequeuePos + 1)
+      break;
+
+    writeLine(slot->level, slot->time, slot->text);
+    slot->seq.store(dequeuePos + LOG_RING_SLOTS, std::memory_order_release);
+    dequeuePos++;
+    written = true;
+  }
+
+  uint32_t dropped = droppedCount.exchange(0);
+  if (dropped)
+  {
+    char text[64];
+    snprintf(text, sizeof(text), "logger: dropped %u messages, ring full", dropped);
+    writeLine(LOG_LEVEL_WARN, time(NULL), text);
+    written = true;
+  }
+
+  return written;
+}
+
+static bool ringEmpty()
+{
+  LogSlot *slot = &logRing[dequeuePos & (LOG_RING_SLOTS - 1)];
+  return slot->seq.load(std::memory_order_acquire) != dequeuePos + 1;
+}
+
+static void writerLoop()
+{
+  while (true)
+  {
+    if (drainRing())
+      flushLines();
+
+    if (!writerRunning.load())
+      break;
+
+    // Sleep until a producer wakes us, rechecking
+    // after flagging we are waiting to avoid a lost wakeup
+    uint32_t wake = writerWake.load();
+    writerWaiting.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ringEmpty() && writerRunning.load())
+      writerWake.wait(wake);
+    writerWaiting.store(false);
+  }
+
+  drainRing();
+  flushLines();
+}
+
+// Queue a message for the writer thread.  Messages are
+// dropped rather than blocking the caller if the ring is full.
+static void enqueueMessage(uint8_t level, const char *fmt, va_list argptr)
+{
+  LogSlot *slot;
+  size_t pos = enqueuePos.load(std::memory_order_relaxed);
+
+  while (true)
+  {
+    slot = &logRing[pos & (LOG_RING_SLOTS - 1)];
+    size_t seq = slot->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+    if (diff == 0) {
+      if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      droppedCount++;
+      return;
+    } else {
+      pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->level = level;
+  slot->time = time(NULL);
+  vsnprintf(slot->text, LOG_MSG_LEN, fmt, argptr);
+  slot->seq.store(pos + 1, std::memory_order_release);
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (writerWaiting.load())
+  {
+    writerWake++;
+    writerWake.notify_one();
+  }
+}
+
+void initLogger(size_t logSize)
+{
+  if (LOG_TO_FILE && !openLogFile(logSize)) {
+    fprintf(stderr, "unable to create log file %s: %s\n", LOG_PATH, strerror(errno));
   }
+
+  for (size_t i = 0; i < LOG_RING_SLOTS; i++)
+    logRing[i].seq.store(i, std::memory_order_relaxed);
+  enqueuePos = dequeuePos = 0;
+
+  // Make sure queued messages are written if we exit early
+  writerRunning = true;
+  writerThread = std::thread(writerLoop);
+  atexit(shutdownLogger);
 }
 
 void shutdownLogger()
 {
-  if (LOG_TO_FILE) {
-    fclose(logger);
+  if (writerRunning.exchange(false))
+  {
+    writerWake++;
+    writerWake.notify_one();
+    writerThread.join();
   }
+
+  closeLogFile();
 }
 
-void _error(const char *fmt, ...)
+// Stop (or resume) writing lines to stdout, they are
+// still written to the log file
+void setConsoleLogging(bool enabled)
+{
+  logConsole = enabled;
+}
+
+// Function names are parenthesized, as they
+// may also be defined as macros by level filtering
+void (_error)(const char *fmt, ...)
 {
   va_list argptr;
   va_start(argptr, fmt);
-  __logHelper(TERM_RED "[err]  ", fmt, argptr);
+  __logHelper(LOG_LEVEL_ERROR, fmt, argptr);
   va_end(argptr);
 }
 
-void _warn(const char *fmt, ...)
+void (_warn)(const char *fmt, ...)
 {
   va_list argptr;
   va_start(argptr, fmt);
-  __logHelper(TERM_YELLOW "[warn] ", fmt, argptr);
+  __logHelper(LOG_LEVEL_WARN, fmt, argptr);
   va_end(argptr);
 }
 
-void _log(const char *fmt, ...)
+void (_log)(const char *fmt, ...)
 {
   va_list argptr;
   va_start(argptr, fmt);
-  __logHelper(TERM_BLUE "[info] ", fmt, argptr);
+  __logHelper(LOG_LEVEL_INFO, fmt, argptr);
   va_end(argptr);
 }
 
-void _debug(const char *fmt, ...)
+void (_debug)(const char *fmt, ...)
 {
   va_list argptr;
   va_start(argptr, fmt);
-  __logHelper("[dbg]  ", fmt, argptr);
+  __logHelper(LOG_LEVEL_DEBUG, fmt, argptr);
   va_end(argptr);
 }
 
 
-void _error(std::string fmt, ...)
+void (_error)(std::string fmt, ...)
 {
   va_list argptr;
   va_start(argptr, fmt);
-  _error(fmt.c_str(), argptr);
+  __logHelper(LOG_LEVEL_ERROR, fmt.c_str(), argptr);
   va_end(argptr);
 }
 
-void _warn(std::string fmt, ...)
+void (_warn)(std::string fmt, ...)
 {
   va_list argptr;
   va_start(argptr, fmt);
-  _warn(fmt.c_str(), argptr);
+  __logHelper(LOG_LEVEL_WARN, fmt.c_str(), argptr);
   va_end(argptr);
 }
 
-void _log(std::string fmt, ...)
+void (_log)(std::string fmt, ...)
 {
   va_list argptr;
   va_start(argptr, fmt);
-  _log(fmt.c_str(), argptr);
+  __logHelper(LOG_LEVEL_INFO, fmt.c_str(), argptr);
   va_end(argptr);
 }
 
-void _debug(std::string fmt, ...)
+void (_debug)(std::string fmt, ...)
 {
   va_list argptr;
   va_start(argptr, fmt);
-  _debug(fmt.c_str(), argptr);
+  __logHelper(LOG_LEVEL_DEBUG, fmt.c_str(), argptr);
   va_end(argptr);
 }
 
-void __logHelper(const char *header, const char *fmt, va_list argptr)
+// Queue a message, or write it directly if the
+// writer thread is not running (startup/shutdown)
+void __logHelper(uint8_t level, const char *fmt, va_list argptr)
+{
+  if (writerRunning.load(std::memory_order_relaxed)) {
+    enqueueMessage(level, fmt, argptr);
+    return;
+  }
+
+  char text[LOG_MSG_LEN];
+  vsnprintf(text, sizeof(text), fmt, argptr);
+  writeLine(level, time(NULL), text);
+  flushLines();
+}
+
+// Returns true if a rate-limited message should be logged,
+// noting how many were suppressed since the last one
+bool __logRateLimit(LogLimit &limit, std::chrono::milliseconds interval)
 {
-  // TODO: This can be cleaned up and modified to a single stream
-  printf("%s %s%s", timestamp(), header, TERM_DEFAULT);
-  vprintf(fmt, argptr);
-  printf("\n");
+  int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  int64_t next = limit.next.load(std::memory_order_relaxed);
 
-  if (LOG_TO_FILE) {
-    fprintf(logger, "%s %s%s", timestamp(), header, TERM_DEFAULT);
-    vfprintf(logger, fmt, argptr);
-    fprintf(logger, "\n");
-    fflush(logger);
+  if (now < next || !limit.next.compare_exchange_strong(next, now + interval.count())) {
+    limit.suppressed++;
+    return false;
   }
+
+  uint32_t suppressed = limit.suppressed.exchange(0);
+  if (suppressed)
+    (_warn)("(%u similar messages suppressed)", suppressed);
+  return true;
 }
 
 // https://stackoverflow.com/questions/1666802/is-there-a-class-macro-in-c
@@ -1,7 +1,12 @@
 #include "mqtt.h"
 #include "logger.h"
+#include "startup.h"
+#include "taskpool.h"
 
 #include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <thread>
 
 #include <unistd.h>
 #include <stdlib.h>
@@ -18,34 +23,107 @@ void showMessage(char *topic, char *payload)
   _log("message arrived on %s: %s", topic, payload);
 }
 
+static std::shared_future<int> connectTask;
+static const char *mqttStateNames[] = {"disconnected", "connecting", "connected"};
+
+// Subscribe to topics for data.  If the broker supports them, each
+// topic is subscribed with the index of its handler as its
+// subscription identifier so messages can be dispatched without
+// comparing topics.  Otherwise topics are batched by QoS level.
+// Our first subscriptions always get the retained messages, as a
+// session resumed after a restart may already hold them.  Later
+// resubscribes only get them for subscriptions new to the session.
+static void mqttSubscribe(const mosquitto_property *connack)
+{
+  int err;
+  uint8_t idsAvailable = 1;
+  int options = mqtt.subscribed ? MQTT_SUB_OPT_SEND_RETAIN_NEW :
+    MQTT_SUB_OPT_SEND_RETAIN_ALWAYS;
+
+  mosquitto_property_read_byte(connack, MQTT_PROP_SUBSCRIPTION_ID_AVAILABLE,
+    &idsAvailable, false);
+
+  if (idsAvailable)
+  {
+    for (uint8_t i = 0; i < numTopicHandlers; i++)
+    {
+      mosquitto_property *props = NULL;
+      mosquitto_property_add_varint(&props, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, i + 1);
+      err = mosquitto_subscribe_v5(mqtt.client, NULL, topicHandlers[i].topic,
+        topicHandlers[i].qos, options, props);
+      if (err)
+        _error("unable to subscribe to %s: rc=%d (%s)", topicHandlers[i].topic, err, mosquitto_strerror(err));
+      mosquitto_property_free_all(&props);
+    }
+  }
+  else
+  {
+    _warn("broker has no subscription identifiers, dispatching by topic");
+    for (uint8_t qos = 0; qos <= 1; qos++)
+    {
+      char *topics[numTopicHandlers];
+      int count = 0;
+
+      for (uint8_t i = 0; i < numTopicHandlers; i++) {
+        if (topicHandlers[i].qos == qos)
+          topics[count++] = (char *)topicHandlers[i].topic;
+      }
+      if (count == 0)
+        continue;
+
+      err = mosquitto_subscribe_multiple(mqtt.client, NULL, count, topics, qos, options, NULL);
+      if (err)
+        _error("unable to subscribe to topics: rc=%d (%s)", err, mosquitto_strerror(err));
+    }
+  }
+
+  mqtt.subscribed = true;
+}
+
 // Callback after MQTT connection
-void mqttOnConnect(struct mosquitto *mqttConnect, void *obj, int rc)
+void mqttOnConnect(struct mosquitto *mqttConnect, void *obj, int rc, int flags,
+  const mosquitto_property *props)
 {
-  _log("MQTT connected: rc=%d (%s)", rc, mosquitto_connack_string(rc));
+  bool sessionPresent = flags & 0x01;
+
+  _log("MQTT connected: rc=%d (%s), session %s", rc, mosquitto_reason_string(rc),
+    sessionPresent ? "resumed" : "new");
   if (rc != 0) {
-    _error("- exiting");
-    exit(-1);
+    // The client loop returns an error after this, which
+    // schedules our next attempt
+    _error("- connection refused");
+    return;
   }
 
-  _debug("connected, subscribing to MQTT topics");
   // _debug("struct MQTT @ %p", mqttConnect);
 
-  mqtt.connected = true;
-
-  // Subscribe to topics for data
-  mosquitto_subscribe(mqtt.client, NULL, HASS_OUT_TEMP, 0);
-  mosquitto_subscribe(mqtt.client, NULL, HASS_OUT_DEW, 0);
-  mosquitto_subscribe(mqtt.client, NULL, HASS_OUT_PM25, 0);
-  mosquitto_subscribe(mqtt.client, NULL, HASS_LR_TEMP, 0);
-  mosquitto_subscribe(mqtt.client, NULL, HASS_LR_DEW, 0);
-  mosquitto_subscribe(mqtt.client, NULL, PIWEATHER_MAX_WIND, 0);
-  mosquitto_subscribe(mqtt.client, NULL, PIWEATHER_RAINFALL, 0);
-  mosquitto_subscribe(mqtt.client, NULL, "thermostat/#", 0);
-  mosquitto_subscribe(mqtt.client, NULL, "weather/#", 0);
-  mosquitto_subscribe(mqtt.client, NULL, "sign/#", 0);
-  mosquitto_subscribe(mqtt.client, NULL, "icon/#", 0);
-  mosquitto_subscribe(mqtt.client, NULL, "debug/#", 0);
-  mosquitto_subscribe(mqtt.client, NULL, "calendar/#", 0);
+  auto now = steady_clock::now();
+  if (mqtt.failures > 0 || mqtt.disconnects > 0)
+    _log("MQTT back after %lld s, %u failed attempts",
+      (long long) std::chrono::duration_cast<std::chrono::seconds>(now - mqtt.downSince).count(),
+      mqtt.failures);
+
+  static bool firstConnect = true;
+  if (firstConnect) {
+    startupMark("mqtt connected");
+    firstConnect = false;
+  }
+
+  mqtt.state = MQTT_CONNECTED;
+  mqtt.stateTime = now;
+  mqtt.downtime += now - mqtt.downSince;
+  mqtt.failures = 0;
+
+  // A resumed session keeps our subscriptions, and the broker sends
+  // any QoS 1 messages we missed.  We always subscribe after starting
+  // in case our topics changed, and get the retained messages then.
+  if (sessionPresent && mqtt.subscribed) {
+    _debug("session resumed, not resubscribing");
+    return;
+  }
+
+  _debug("connected, subscribing to MQTT topics");
+  mqttSubscribe(props);
 }
 
 // Create a new MQTT client
@@ -56,10 +134,20 @@ int createMqttClient()
   mqtt.port = 1883;
   mqtt.keepalive = 60;
   mqtt.server = (char *)MQTT_HOST;
-  snprintf(mqtt.clientId, MQTT_CLIENT_ID_LEN, "%s-%d", MQTT_CLIENT_DEFAULT, rand() % 65536);
+
+  // Another broker, eg. a local one when previewing off the device
+  if (getenv(MQTT_HOST_ENV))
+    mqtt.server = getenv(MQTT_HOST_ENV);
+
+  // Our client ID is kept across restarts so the broker
+  // can resume our session, see MQTT_SESSION_EXPIRY
+  char hostname[32] = "";
+  gethostname(hostname, sizeof(hostname) - 1);
+  snprintf(mqtt.clientId, MQTT_CLIENT_ID_LEN, "%s-%s", MQTT_CLIENT_DEFAULT, hostname);
 
   _debug("New MQTT connect client ID: %s", mqtt.clientId);
-  mqtt.client = mosquitto_new(mqtt.clientId, true, NULL);
+  mqtt.hostSet = false;
+  mqtt.client = mosquitto_new(mqtt.clientId, false, NULL);
   if (mqtt.client == NULL)
   {
     _error("unable to initialize new MQTT client, aborting");
@@ -73,44 +161,187 @@ int createMqttClient()
     return false;
   }
 
-  mosquitto_connect_callback_set(mqtt.client, mqttOnConnect);
-  mosquitto_message_callback_set(mqtt.client, mqttOnMessage);
+  // MQTT v5 gives us subscription identifiers and topic aliases
+  mosquitto_int_option(mqtt.client, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+
+  mosquitto_connect_v5_callback_set(mqtt.client, mqttOnConnect);
+  mosquitto_message_v5_callback_set(mqtt.client, mqttOnMessageV5);
 
   return true;
 }
 
-// Connect to a local MQTT server that provides all the data
-// This will retry forever until connected or interrupted
-int mqttConnect()
+// Schedule our next connect attempt after a failure, waiting
+// longer after each consecutive failure.  The random part of the
+// wait spreads out reconnects, eg. after a broker restart.
+static void scheduleReconnect()
+{
+  auto now = steady_clock::now();
+
+  if (mqtt.state == MQTT_CONNECTED) {
+    mqtt.disconnects++;
+    mqtt.downSince = now;
+  }
+  mqtt.state = MQTT_DISCONNECTED;
+  mqtt.stateTime = now;
+  mqtt.failures++;
+
+  milliseconds wait = MQTT_CONNECT_WAIT * (1 << std::min(mqtt.failures - 1, 16u));
+  wait = std::min(wait, milliseconds(MQTT_CONNECT_WAIT_MAX));
+  wait -= milliseconds(rand() % (wait.count() / 2 + 1));
+  mqtt.nextAttempt = now + wait;
+
+  _warn("MQTT reconnecting in %lld ms, attempt %u", (long long) wait.count(),
+    mqtt.failures + 1);
+}
+
+// Handle an error from the client loop, which
+// may be during a connect attempt
+void mqttConnectionLost(int rc)
+{
+  if (mqtt.state == MQTT_DISCONNECTED)
+    return;
+
+  _error("MQTT connection error, rc=%d (%s)", rc, mosquitto_strerror(rc));
+  if (rc == MOSQ_ERR_ERRNO)
+    _error("got errno %d on system call (%s)", errno, strerror(errno));
+
+  mosquitto_disconnect(mqtt.client);
+  scheduleReconnect();
+}
+
+// Build a new client, in case the old one is in a bad state
+static bool rebuildMqttClient()
+{
+  _warn("MQTT failed %u times, rebuilding client", mqtt.failures);
+  mqtt.rebuilds++;
+
+  mosquitto_destroy(mqtt.client);
+  mqtt.client = NULL;
+  return createMqttClient();
+}
+
+// Check a connect attempt on the task pool, once it has finished
+// the client loop waits for the broker to accept our connection
+static void checkConnectTask()
 {
-  int rc, mqRetries = 1;
-  int connectWait = MQTT_CONNECT_WAIT;
+  if (connectTask.wait_for(0s) != std::future_status::ready)
+    return;
+
+  int rc = connectTask.get();
+  connectTask = std::shared_future<int>();
 
-  // Loop while we're not connected to MQTT and system is running
-  while (!mqtt.connected && girderRunning)
+  if (rc != MOSQ_ERR_SUCCESS)
   {
-    _debug("MQTT connect attempt %d", mqRetries);
-    rc = mosquitto_connect(mqtt.client, mqtt.server, mqtt.port, mqtt.keepalive);
-    if (rc == MOSQ_ERR_SUCCESS)
-    {
-      // We set connected = true here in order to prevent the main loop
-      // from reconnecting; if the actual connection isn't established
-      // (on_connect callback) then an error will be caught and connection
-      // state will reset to false
-      mqtt.connected = true;
-      return true;
+    _error("MQTT connection failed, attempt %d: rc=%d (%s)", mqtt.failures + 1, rc,
+      mosquitto_strerror(rc));
+    scheduleReconnect();
+    return;
+  }
+
+  // Connected, wait for the broker's answer from now
+  mqtt.stateTime = steady_clock::now();
+}
+
+// Connect to a local MQTT server that provides all the data, called
+// every loop to start connect attempts when due and check for a
+// connect taking too long.  This doesn't block, the connection
+// is made on the task pool then completed by the client loop
+// (mqttOnConnect callback).
+void mqttCheckConnection()
+{
+  auto now = steady_clock::now();
+
+  if (connectTask.valid())
+  {
+    checkConnectTask();
+    return;
+  }
+
+  if (mqtt.state == MQTT_CONNECTING && now - mqtt.stateTime > MQTT_CONNECT_TIMEOUT)
+  {
+    _error("MQTT connect attempt timed out");
+    mosquitto_disconnect(mqtt.client);
+    scheduleReconnect();
+    return;
+  }
+
+  if (mqtt.state != MQTT_DISCONNECTED || now < mqtt.nextAttempt)
+    return;
+
+  if (mqtt.client == NULL || (mqtt.failures > 0 &&
+      mqtt.failures % MQTT_REBUILD_FAILURES == 0))
+  {
+    if (!rebuildMqttClient()) {
+      scheduleReconnect();
+      return;
+    }
+  }
+
+  _debug("MQTT connect attempt %d", mqtt.failures + 1);
+  mqtt.attempts++;
+  mqtt.state = MQTT_CONNECTING;
+  mqtt.stateTime = now;
+
+  // Connecting with v5 properties blocks, so is run on the
+  // task pool and we don't touch the client until it's done
+  connectTask = taskPool.submit([client = mqtt.client, server = mqtt.server,
+      port = mqtt.port, keepalive = mqtt.keepalive, reconnect = mqtt.hostSet]()
+  {
+    int rc;
+    if (reconnect) {
+      rc = mosquitto_reconnect(client);
+    } else {
+      mosquitto_property *props = NULL;
+      mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, MQTT_TOPIC_ALIAS_MAX);
+      mosquitto_property_add_int32(&props, MQTT_PROP_SESSION_EXPIRY_INTERVAL, MQTT_SESSION_EXPIRY);
+      rc = mosquitto_connect_bind_v5(client, server, port, keepalive, NULL, props);
+      mosquitto_property_free_all(&props);
     }
 
-    _error("MQTT connection failed, attempt %d: rc=%d (%s)", mqRetries++, rc, mosquitto_strerror(rc));
-    sleep(connectWait);
+    // errno is only meaningful on this thread
+    if (rc == MOSQ_ERR_ERRNO)
+      _error("MQTT connect: %s", strerror(errno));
+    return rc;
+  });
+  mqtt.hostSet = true;
+}
+
+// If the client can be used, ie. we're not waiting to connect
+bool mqttClientReady()
+{
+  return mqtt.state != MQTT_DISCONNECTED && !connectTask.valid();
+}
 
-    // TODO: In event of repeated failures, try to create new client and
-    // reset libraries/connections/etc from scratch
-    if (connectWait < MQTT_CONNECT_WAIT_MAX)
-      connectWait++;
+// Wait while the client can't be used, until our next
+// connect attempt or the current one finishes
+void mqttWait(milliseconds timeout)
+{
+  if (connectTask.valid()) {
+    connectTask.wait_for(timeout);
+    return;
   }
 
-  return true;
+  auto wait = std::chrono::ceil<milliseconds>(mqtt.nextAttempt - steady_clock::now());
+  std::this_thread::sleep_for(std::clamp(wait, 0ms, timeout));
+}
+
+void mqttLogStats()
+{
+  auto now = steady_clock::now();
+  if (mqtt.state != MQTT_CONNECTED) {
+    mqtt.downtime += now - mqtt.downSince;
+    mqtt.downSince = now;
+  }
+
+  _log("stats: mqtt state=%s attempts=%u failing=%u disconnects=%u "
+    "rebuilds=%u downtime=%llds messages=%u", mqttStateNames[mqtt.state],
+    mqtt.attempts, mqtt.failures, mqtt.disconnects, mqtt.rebuilds,
+    (long long) std::chrono::duration_cast<std::chrono::seconds>(mqtt.downtime).count(),
+    mqtt.messages - mqtt.statsMessages);
+
+  mqtt.attempts = mqtt.disconnects = mqtt.rebuilds = 0;
+  mqtt.downtime = steady_clock::duration::zero();
+  mqtt.statsMessages = mqtt.messages;
 }
 
 void mqttShutdown()
@@ -0,0 +1,282 @@
+#include "page.h"
+#include "display.h"
+#include "clock.h"
+#include "logger.h"
+#include "trace.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+PageManager pageManager;
+
+
+PageSurface::PageSurface(int w, int h) : Surface(w, h),
+  spanStart(h, 0), spanEnd(h, 0)
+{
+  Fill(0, 0, 0);
+}
+
+// Set a pixel, extending the dirty span of its row
+void PageSurface::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b)
+{
+  if (x < 0 || y < 0 || x >= width() || y >= height())
+    return;
+
+  Surface::SetPixel(x, y, r, g, b);
+  if (spanStart[y] == spanEnd[y]) {
+    spanStart[y] = x;
+    spanEnd[y] = x + 1;
+  } else {
+    spanStart[y] = std::min<int16_t>(spanStart[y], x);
+    spanEnd[y] = std::max<int16_t>(spanEnd[y], x + 1);
+  }
+}
+
+// Pages are always opaque, so clearing is to black
+void PageSurface::Clear()
+{
+  Fill(0, 0, 0);
+}
+
+void PageSurface::Fill(uint8_t r, uint8_t g, uint8_t b)
+{
+  Surface::Fill(r, g, b);
+  markDirty();
+}
+
+void PageSurface::markDirty()
+{
+  std::fill(spanStart.begin(), spanStart.end(), 0);
+  std::fill(spanEnd.begin(), spanEnd.end(), width());
+}
+
+// Copy the spans drawn since we were last presented
+void PageSurface::present(rgb_matrix::Canvas *out)
+{
+  for (int y = 0; y < height(); y++)
+  {
+    for (int x = spanStart[y]; x < spanEnd[y]; x++) {
+      auto rgb = getPixel(x, y);
+      out->SetPixel(x, y, rgb[0], rgb[1], rgb[2]);
+    }
+    spanStart[y] = spanEnd[y] = 0;
+  }
+}
+
+// Copy the whole canvas, offset horizontally (clipped to the
+// output) for transitions.  Spans are left for present().
+void PageSurface::blit(rgb_matrix::Canvas *out, int offsetX)
+{
+  int start = std::max(0, -offsetX);
+  int end = std::min(width(), out->width() - offsetX);
+
+  for (int y = 0; y < std::min(height(), out->height()); y++) {
+    for (int x = start; x < end; x++) {
+      auto rgb = getPixel(x, y);
+      out->SetPixel(x + offsetX, y, rgb[0], rgb[1], rgb[2]);
+    }
+  }
+}
+
+
+Page::Page(const char *name, WidgetManager *widgets, bool clock, milliseconds dwell)
+  : name(name), widgets(widgets), clock(clock), dwell(dwell),
+    cache(DISPLAY_WIDTH, DISPLAY_HEIGHT) {}
+
+
+// Add a page, its widgets are composited to its canvas from now on
+bool PageManager::addPage(Page *page)
+{
+  if (numPages == PAGE_MAX) {
+    _error("unable to add page %s, limit of %d reached", page->name, PAGE_MAX);
+    return false;
+  }
+  page->widgets->setTarget(&page->cache);
+  pages[numPages++] = page;
+  return true;
+}
+
+uint8_t PageManager::size(void)
+{
+  return numPages;
+}
+
+Page* PageManager::operator[](uint8_t index)
+{
+  return (index < numPages) ? pages[index] : NULL;
+}
+
+// Pages are only rotated to once they have something to show
+bool PageManager::isReady(Page *page)
+{
+  return page->clock || page->widgets->hasData();
+}
+
+void PageManager::swapTo(uint8_t page, bool slide)
+{
+  auto now = steady_clock::now();
+  nextSwap = now + pages[page]->dwell;
+  if (page == shown)
+    return;
+
+  _debug("page: showing %s", pages[page]->name);
+  if (slide) {
+    leaving = shown;
+    slideStart = now;
+    nextSwap += PAGE_SLIDE_TIME;
+  }
+  shown = page;
+  swapped = true;
+}
+
+// Swap to the next page with data once the shown one has
+// been up for its dwell time
+void PageManager::checkRotation(steady_clock::time_point now)
+{
+  if (nextSwap == steady_clock::time_point())
+    nextSwap = now + pages[shown]->dwell;
+  if (!rotating || numPages < 2 || leaving != PAGE_NONE || now < nextSwap)
+    return;
+
+  for (uint8_t i = 1; i < numPages; i++)
+  {
+    uint8_t next = (shown + i) % numPages;
+    if (isReady(pages[next])) {
+      swapTo(next, sliding);
+      return;
+    }
+  }
+  nextSwap = now + pages[shown]->dwell;
+}
+
+// Bring a page's canvas up to date with its widgets, the same
+// steps as a single dashboard drawn directly to the display
+void PageManager::renderPage(Page *page, bool force, bool timed)
+{
+  TRACE_SPAN_ARG("renderPage", page->name);
+  WidgetManager *widgets = page->widgets;
+
+  // The clock draws to the current canvas
+  if (page->clock) {
+    rgb_matrix::Canvas *display = canvas;
+    canvas = &page->cache;
+    clockRenderer.render(force);
+    canvas = display;
+  }
+
+  // Reset temporary brightness for widgets, if necessary
+  // Recalculate brightness for widgets, assuming there was an
+  // update to the global value if a force refresh was done
+  widgets->checkResetUpdateBrightness(force);
+  if (force)
+    widgets->displayDashboard();
+
+  // Render widgets updated by messages this frame
+  widgets->renderDirty();
+
+  // Update any dynamic widgets, only on the shown page
+  if (timed) {
+    TRACE_SPAN("checkUpdate");
+    widgets->checkUpdate();
+  }
+}
+
+// Draw a frame of the new page sliding in over the old
+// one, returning false once the slide is over
+bool PageManager::drawSlide(rgb_matrix::Canvas *out, steady_clock::time_point now)
+{
+  float progress = std::chrono::duration<float>(now - slideStart) /
+      std::chrono::duration<float>(PAGE_SLIDE_TIME);
+  if (progress >= 1.0) {
+    leaving = PAGE_NONE;
+    return false;
+  }
+
+  // Ease out, slowing as the new page settles
+  int width = out->width();
+  int offset = width - (int) (width * (1.0 - (1.0 - progress) * (1.0 - progress)));
+  pages[leaving]->cache.blit(out, offset - width);
+  pages[shown]->cache.blit(out, offset);
+  return true;
+}
+
+// Update every page, then show the current one (or a frame
+// of the transition to it)
+void PageManager::render(rgb_matrix::Canvas *out, bool force)
+{
+  if (numPages == 0)
+    return;
+
+  auto now = steady_clock::now();
+  checkRotation(now);
+
+  for (uint8_t i = 0; i < numPages; i++)
+    renderPage(pages[i], force, i == shown);
+
+  if (leaving != PAGE_NONE && drawSlide(out, now))
+    return;
+
+  PageSurface &cache = pages[shown]->cache;
+  if (swapped) {
+    TRACE_SPAN("swapPage");
+    cache.markDirty();
+    swapped = false;
+  }
+  cache.present(out);
+}
+
+// Time until the shown page next changes, or the next
+// frame of a transition or swap
+milliseconds PageManager::nextUpdateIn(void)
+{
+  if (numPages == 0)
+    return WIDGET_IDLE_PERIOD;
+  if (leaving != PAGE_NONE)
+    return PAGE_FRAME_PERIOD;
+
+  // The clock is kept up to date while hidden, so it
+  // is current when its page is swapped to
+  milliseconds wait = pages[shown]->widgets->nextUpdateIn();
+  for (uint8_t i = 0; i < numPages; i++) {
+    if (pages[i]->clock)
+      wait = std::min(wait, clockRenderer.nextUpdateIn());
+  }
+
+  if (rotating && numPages > 1) {
+    auto swap = std::chrono::ceil<milliseconds>(nextSwap - steady_clock::now());
+    wait = std::min(wait, std::max(swap, 0ms));
+  }
+  return wait;
+}
+
+// Show a page by name now, without a transition.  It
+// stays for its dwell time if we are rotating.
+bool PageManager::showPage(const char *name)
+{
+  for (uint8_t i = 0; i < numPages; i++)
+  {
+    if (strcmp(pages[i]->name, name) == 0) {
+      if (leaving != PAGE_NONE) {
+        leaving = PAGE_NONE;
+        swapped = true;
+      }
+      swapTo(i, false);
+      return true;
+    }
+  }
+  _warn("page: no page named %s", name);
+  return false;
+}
+
+void PageManager::setRotation(bool value)
+{
+  rotating = value;
+  if (numPages)
+    nextSwap = steady_clock::now() + pages[shown]->dwell;
+}
+
+void PageManager::setSlide(bool value)
+{
+  sliding = value;
+}
@@ -0,0 +1,130 @@
+#include "panel.h"
+#include "display.h"
+#include "statestore.h"
+#include "logger.h"
+#include "startup.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+
+static Panel *panels[PANEL_MAX];
+static uint8_t numPanels = 0;
+
+
+// Pin the calling thread to a core, so rendering doesn't
+// compete with other panels (or the matrix refresh)
+static bool pinThread(const char *name, int core)
+{
+  if (core == PANEL_NO_CORE)
+    return false;
+
+  if (core >= (int) std::thread::hardware_concurrency()) {
+    _warn("panel %s: no core %d to run on, not pinning", name, core);
+    return false;
+  }
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core, &cpus);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    _warn("panel %s: unable to pin render thread to core %d", name, core);
+    return false;
+  }
+  return true;
+}
+
+// Render loop, woken when the store changes or when the
+// layout has an update due (eg. the clock, animations)
+void Panel::run()
+{
+  canvas = exporter ? exporter : target;
+  if (pinThread(name, core))
+    _log("panel %s: rendering %dx%d on core %d", name, target->width(), target->height(), core);
+  else
+    _log("panel %s: rendering %dx%d", name, target->width(), target->height());
+
+  auto nextStatsTime = steady_clock::now() + PANEL_STATS_INTERVAL;
+  while (running.load(std::memory_order_relaxed))
+  {
+    uint32_t seen = stateStore.generation();
+
+    auto start = steady_clock::now();
+    layout->render();
+    if (exporter)
+      exporter->publish();
+    auto elapsed = std::chrono::duration_cast<microseconds>(steady_clock::now() - start);
+    if (frames++ == 0 && !drawn) {
+      startupMark("first frame");
+      drawn = true;
+    }
+    totalRender += elapsed;
+    peakRender = std::max(peakRender, elapsed);
+
+    if (steady_clock::now() >= nextStatsTime) {
+      logStats();
+      layout->logStats();
+      nextStatsTime += PANEL_STATS_INTERVAL;
+    }
+
+    stateStore.waitFor(seen, std::min(layout->nextUpdateIn(),
+        std::chrono::ceil<milliseconds>(nextStatsTime - steady_clock::now())), running);
+  }
+}
+
+void Panel::logStats()
+{
+  _log("stats: panel %s frames=%u render avg=%lldus peak=%lldus", name, frames,
+      frames ? (long long) (totalRender / frames).count() : 0LL,
+      (long long) peakRender.count());
+
+  frames = 0;
+  totalRender = peakRender = 0us;
+}
+
+// Draw through an exporter of our frames, which passes
+// pixels on to our target.  Set before starting.
+void Panel::setExport(FrameExport *frames)
+{
+  exporter = frames;
+}
+
+void Panel::start()
+{
+  running = true;
+  thread = std::thread(&Panel::run, this);
+}
+
+// Wait for the current frame to finish
+void Panel::stop()
+{
+  if (!thread.joinable())
+    return;
+
+  running = false;
+  stateStore.wakeAll();
+  thread.join();
+}
+
+bool addPanel(Panel *panel)
+{
+  if (numPanels == PANEL_MAX) {
+    _error("unable to add panel, limit of %d reached", PANEL_MAX);
+    return false;
+  }
+  panels[numPanels++] = panel;
+  return true;
+}
+
+void startPanels()
+{
+  for (uint8_t i = 0; i < numPanels; i++)
+    panels[i]->start();
+}
+
+void stopPanels()
+{
+  for (uint8_t i = 0; i < numPanels; i++)
+    panels[i]->stop();
+}
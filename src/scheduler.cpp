@@ -0,0 +1,94 @@
+#include "scheduler.h"
+#include "logger.h"
+
+#include <algorithm>
+
+
+AnimationScheduler animScheduler;
+
+
+// Set the animation time budget for a single frame
+void AnimationScheduler::setFrameBudget(microseconds budget)
+{
+  _log("animation frame budget set to %lld us", (long long) budget.count());
+  frameBudget = budget;
+}
+
+// Check if an animation frame of the given cost fits within
+// the remaining budget for this frame.  The first animation
+// in a frame is always admitted, so nothing can be starved.
+bool AnimationScheduler::admit(uint32_t cost)
+{
+  if (frameSpent == 0us)
+    return true;
+
+  auto predicted = microseconds(uint32_t(cost * usPerCost));
+  if (frameSpent + predicted <= frameBudget)
+    return true;
+
+  deferred++;
+  frameDeferred = true;
+  return false;
+}
+
+// Record the time taken to render an animation frame,
+// updating our estimate of the time per unit of cost
+void AnimationScheduler::record(uint32_t cost, microseconds elapsed)
+{
+  frameSpent += elapsed;
+
+  if (cost == 0)
+    return;
+
+  float sample = float(elapsed.count()) / cost;
+  if (usPerCost == 0.0)
+    usPerCost = sample;
+  else
+    usPerCost = 0.9 * usPerCost + 0.1 * sample;
+}
+
+// Called at the end of every main loop iteration, this
+// adjusts the quality level based upon budget pressure
+void AnimationScheduler::endFrame()
+{
+  // Frames without any animation work tell us nothing
+  if (frameSpent == 0us && !frameDeferred)
+    return;
+
+  frames++;
+  totalSpent += frameSpent;
+  peakSpent = std::max(peakSpent, frameSpent);
+
+  if (frameSpent > frameBudget || frameDeferred) {
+    underFrames = 0;
+    if (++overFrames >= ANIM_DEGRADE_FRAMES &&
+        level < ANIM_QUALITY_LEVELS - 1) {
+      level++;
+      overFrames = 0;
+      _warn("animations over budget, degrading quality to level %d", level);
+    }
+  }
+  else if (frameSpent < frameBudget / 2) {
+    overFrames = 0;
+    if (++underFrames >= ANIM_RECOVER_FRAMES && level > 0) {
+      level--;
+      underFrames = 0;
+      _log("animations under budget, restoring quality to level %d", level);
+    }
+  }
+
+  frameSpent = 0us;
+  frameDeferred = false;
+}
+
+// Log animation stats since the last call
+void AnimationScheduler::logStats()
+{
+  [[maybe_unused]] auto avg = frames ? totalSpent.count() / frames : 0;
+  _log("stats: animation level=%d frames=%u avg=%lldus peak=%lldus "
+    "deferred=%u budget=%lldus", level, frames, (long long) avg,
+    (long long) peakSpent.count(), deferred, (long long) frameBudget.count());
+
+  frames = deferred = 0;
+  totalSpent = peakSpent = 0us;
+}
@@ -7,6 +7,7 @@
 
 #include <string>
 #include <cerrno>
+#include <algorithm>
 
 #include "logger.h"
 #include "display.h"
@@ -16,7 +17,23 @@
 #include "widget.h"
 #include "dynamicwidget.h"
 #include "widgetmanager.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "clock.h"
+#include "state.h"
+#include "startup.h"
+#include "capture.h"
+#include "panel.h"
+#include "frameexport.h"
 
+#define STATS_INTERVAL    60s
+
+// Longest time to wait for MQTT messages in the main loop
+#define MQTT_LOOP_TIMEOUT 200ms
+
+// Most extra (non-blocking) MQTT loops while messages
+// keep arriving, before other main loop work
+#define MQTT_DRAIN_MAX    32
 
 // Various vars for main functions
 volatile bool girderRunning = true;
@@ -37,16 +54,24 @@ void handleSignal(int signal)
     printf("shutting down...\n");
 }
 
+// Dump recent trace spans, eg. after a stutter
+void handleTraceSignal(int signal)
+{
+    requestTraceDump();
+}
+
 int main(int argc, char **argv)
 {
   int rc; //, opt;
   uint8_t configNum = 0;
+  steady_clock::time_point nextStatsTime = steady_clock::now() + STATS_INTERVAL;
 
   initLogger();
   _log("starting up");
 
   signal(SIGINT, handleSignal);
   signal(SIGTERM, handleSignal);
+  signal(SIGUSR1, handleTraceSignal);
   srand((unsigned) time(NULL));
 
   // while ((opt = getopt(argc, argv, "abc:")) != -1)
@@ -73,7 +98,7 @@ int main(int argc, char **argv)
   for (int index = optind; index < argc; index++)
   {
     char *arg = argv[index];
-    if (atoi(arg) < 1 || atoi(arg) > 3) {
+    if (atoi(arg) < 1 || atoi(arg) > DISPLAY_CONFIG_TERMINAL) {
       fprintf(stderr, "missing required parameter CONFIG_NUM\n");
       return 1;
     }
@@ -84,26 +109,51 @@ int main(int argc, char **argv)
     }
   }
 
-  // Display initialization
-  if (!setupDisplay(configNum)) {
-    _error("failed to initialize display, exiting");
-    return 1;
-  }
-  setupDashboard();
+  // Slow startup work (font parsing and icon decoding)
+  // is run in parallel on a task pool
+  taskPool.start();
 
-  // MQTT initialization
+  // MQTT initialization, we connect from the main loop
   // drawIcon(weatherOffset+32+3, 0+3, 25, 25, mqtt);
-  mqtt.connected = false;
+  mqtt.state = MQTT_DISCONNECTED;
+  mqtt.downSince = mqtt.nextAttempt = steady_clock::now();
+  mosquitto_lib_init();
   if (!createMqttClient())
   {
     _error("unable to build client, exiting");
     girderRunning = false;
   }
-  else
-  {
-    mosquitto_lib_init();
-    mqttConnect();
+
+  // Display initialization
+  auto phaseStart = steady_clock::now();
+  if (!setupDisplay(configNum)) {
+    _error("failed to initialize display, exiting");
+    girderRunning = false;
+    return 1;
   }
+  startupPhaseDone("display init", phaseStart);
+
+  phaseStart = steady_clock::now();
+  setupDashboard();
+  startupPhaseDone("layout", phaseStart);
+
+  // Show our last known state until the broker sends updates
+  if (initState())
+    restoreState();
+
+  // Fonts are needed to draw our first frame
+  waitForFonts();
+  startupMark("ready to draw");
+
+  // The dashboard is drawn by the matrix panel's render thread,
+  // this thread only receives and parses messages.  Its frames
+  // are also published to shared memory, for viewers.
+  FrameExport matrixFrames(canvas);
+  Panel matrixPanel("matrix", &dashboardLayout, canvas, PANEL_RENDER_CORE);
+  if (matrixFrames.open())
+    matrixPanel.setExport(&matrixFrames);
+  addPanel(&matrixPanel);
+  startPanels();
 
   /*
     ----==== [ Main Loop ] ====----
@@ -113,61 +163,58 @@ int main(int argc, char **argv)
     // TODO: Stop tracking durations this way, use the actual clock
     cycle++;
 
-    // Connect to MQTT if necessary
-    mqttConnect();
+    auto loopTimeout = milliseconds(MQTT_LOOP_TIMEOUT);
 
-    // MQTT loop to pick up messages
-    // _debug("calling mqtt_loop");
-    rc = mosquitto_loop(mqtt.client, 200, 1);
-    if (rc)
+    // Connect to MQTT if necessary, this doesn't block
+    mqttCheckConnection();
+
+    uint32_t received = mqtt.messages;
+    if (!mqttClientReady())
     {
-      mqtt.connected = false;
-
-      _error("MQTT connection error, rc=%d", rc);
-      if (rc == MOSQ_ERR_ERRNO)
-      {
-        _error("got errno %d on system call", errno);
-        girderRunning = false;
-        continue;
-      }
-
-      _error("reconnecting");
-      sleep(MQTT_CONNECT_WAIT);
-      mosquitto_reconnect(mqtt.client);
-      continue;
+      // Panels keep drawing while we wait for our next connect attempt
+      mqttWait(loopTimeout);
+      rc = MOSQ_ERR_SUCCESS;
     }
-
-    // Show the clock and update it as needed
-    displayClock();
-
-    // Reset temporary brightness for widgets, if necessary
-    // Recalculate brightness for widgets, assuming there was an
-    // update to the global value if a force refresh was done
-    widgets.checkResetUpdateBrightness(forceRefresh);
-
-    // Force refresh of the display
-    if (forceRefresh)
+    else
     {
-      _log("forcing dashboard refresh");
+      // MQTT loop to pick up messages
+      // _debug("calling mqtt_loop");
+      rc = mosquitto_loop(mqtt.client, loopTimeout.count(), 1);
+    }
 
-      displayClock(true);
-      displayDashboard();
-      forceRefresh = false;
+    // Handle any further queued messages (eg. retained topics
+    // replayed on connect) before our housekeeping below
+    for (auto i = 0; rc == MOSQ_ERR_SUCCESS && i < MQTT_DRAIN_MAX &&
+        mqtt.messages != received; i++) {
+      received = mqtt.messages;
+      rc = mosquitto_loop(mqtt.client, 0, 1);
     }
 
-    // Pause between cycles, after startup has finished
-    // if (clock() > 5.0 * CLOCKS_PER_SEC) {
-    //   sleep(0.1);
-    //   // wWeatherAlerts.clearIcon();
-    // }
+    // Reconnects are scheduled, panels keep rendering meanwhile
+    if (rc)
+      mqttConnectionLost(rc);
+
+    checkTraceDump();
+    checkSaveState();
+    checkFlushCapture();
 
-    // Update any dynamic widgets
-    widgets.checkUpdate();
+    // Periodically log runtime stats
+    if (steady_clock::now() >= nextStatsTime)
+    {
+      mqttLogStats();
+      nextStatsTime += STATS_INTERVAL;
+    }
   }
 
+  // Let any startup tasks, and frames being drawn, finish
+  taskPool.stop();
+  stopPanels();
+
   _log("closing matrix");
   shutdownDisplay();
   mqttShutdown();
+  shutdownState();
+  stopCapture();
   shutdownLogger();
 
   return 0;
@@ -0,0 +1,25 @@
+#include "startup.h"
+#include "logger.h"
+
+steady_clock::time_point startupTime = steady_clock::now();
+
+
+static long long sinceStartup(steady_clock::time_point when)
+{
+  return std::chrono::duration_cast<milliseconds>(when - startupTime).count();
+}
+
+// Log a point reached during startup
+void startupMark(const char *phase)
+{
+  _log("startup: %s at %lld ms", phase, sinceStartup(steady_clock::now()));
+}
+
+// Log a phase that has finished, with its duration
+void startupPhaseDone(const char *phase, steady_clock::time_point start)
+{
+  auto now = steady_clock::now();
+  _log("startup: %s took %lld ms, done at %lld ms", phase,
+      (long long) std::chrono::duration_cast<milliseconds>(now - start).count(),
+      sinceStartup(now));
+}
@@ -0,0 +1,206 @@
+#include "state.h"
+#include "mqtt.h"
+#include "logger.h"
+
+#include <mosquitto.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+thread_local system_clock::time_point messageTime;
+
+static int stateFd = -1;
+static StateFileHeader *stateFile = NULL;
+
+// Working copy of our entries, saved periodically
+static StateEntry entries[STATE_MAX_ENTRIES];
+static uint32_t numEntries = 0;
+static uint32_t stateSeq = 0;
+static bool stateDirty = false;
+static bool restoring = false;
+static steady_clock::time_point nextSaveTime;
+
+// Live messages are all received after we start
+static const system_clock::time_point startTime = system_clock::now();
+
+
+// FNV-1a hash of a slot's entries
+static uint32_t stateChecksum(const StateEntry *slotEntries, uint32_t count)
+{
+  uint32_t hash = 2166136261u;
+  auto data = (const uint8_t *) slotEntries;
+
+  for (size_t i = 0; i < count * sizeof(StateEntry); i++) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+  return hash ^ count;
+}
+
+static bool slotValid(StateSlot &slot)
+{
+  return (slot.seq.load() != 0 && slot.count <= STATE_MAX_ENTRIES &&
+    slot.checksum == stateChecksum(slot.entries, slot.count));
+}
+
+// Map our state file, loading entries from the newest valid
+// slot.  A file from another version is reinitialized.
+bool initState(void)
+{
+  stateFd = open(STATE_PATH, O_RDWR | O_CREAT, 0644);
+  if (stateFd < 0) {
+    _error("unable to open state file %s", STATE_PATH);
+    return false;
+  }
+
+  if (ftruncate(stateFd, sizeof(StateFileHeader)) != 0) {
+    _error("unable to size state file %s", STATE_PATH);
+    close(stateFd);
+    stateFd = -1;
+    return false;
+  }
+
+  void *map = mmap(NULL, sizeof(StateFileHeader), PROT_READ | PROT_WRITE,
+      MAP_SHARED, stateFd, 0);
+  if (map == MAP_FAILED) {
+    _error("unable to map state file %s", STATE_PATH);
+    close(stateFd);
+    stateFd = -1;
+    return false;
+  }
+  stateFile = (StateFileHeader *) map;
+
+  if (stateFile->magic != STATE_MAGIC || stateFile->version != STATE_VERSION ||
+      stateFile->entrySize != sizeof(StateEntry) ||
+      stateFile->maxEntries != STATE_MAX_ENTRIES)
+  {
+    _log("state: initializing new state file");
+    memset((void *) stateFile, 0, sizeof(StateFileHeader));
+    stateFile->magic = STATE_MAGIC;
+    stateFile->version = STATE_VERSION;
+    stateFile->entrySize = sizeof(StateEntry);
+    stateFile->maxEntries = STATE_MAX_ENTRIES;
+    return true;
+  }
+
+  // Use the valid slot with the highest sequence
+  StateSlot *best = NULL;
+  for (auto &slot : stateFile->slots) {
+    if (slotValid(slot) && (best == NULL || slot.seq > best->seq))
+      best = &slot;
+  }
+
+  if (best) {
+    numEntries = best->count;
+    stateSeq = best->seq;
+    memcpy(entries, best->entries, numEntries * sizeof(StateEntry));
+  } else {
+    _warn("state: no valid snapshot found");
+  }
+
+  return true;
+}
+
+void shutdownState(void)
+{
+  if (stateDirty) {
+    nextSaveTime = steady_clock::time_point();
+    checkSaveState();
+  }
+
+  if (stateFile)
+    munmap(stateFile, sizeof(StateFileHeader));
+  if (stateFd >= 0)
+    close(stateFd);
+
+  stateFile = NULL;
+  stateFd = -1;
+}
+
+// Record a received message, called for each live
+// message.  Debug topics aren't part of our state.
+void recordState(const char *topic, const char *payload, int length)
+{
+  if (restoring)
+    return;
+
+  messageTime = system_clock::now();
+  if (strncmp(topic, "debug/", 6) == 0)
+    return;
+
+  if (strlen(topic) >= STATE_TOPIC_LEN || length >= STATE_PAYLOAD_LEN) {
+    _warnLimited(std::chrono::minutes(1), "state: not saving %s, too long", topic);
+    return;
+  }
+
+  StateEntry *entry = NULL;
+  for (uint32_t i = 0; i < numEntries && !entry; i++) {
+    if (strcmp(entries[i].topic, topic) == 0)
+      entry = &entries[i];
+  }
+
+  if (entry == NULL)
+  {
+    if (numEntries == STATE_MAX_ENTRIES) {
+      _warnLimited(std::chrono::minutes(1), "state: no room to save %s", topic);
+      return;
+    }
+    entry = &entries[numEntries++];
+    memset(entry, 0, sizeof(StateEntry));
+    strcpy(entry->topic, topic);
+  }
+
+  memcpy(entry->payload, payload, length);
+  memset(entry->payload + length, 0, STATE_PAYLOAD_LEN - length);
+  entry->length = length;
+  entry->received = system_clock::to_time_t(messageTime);
+  stateDirty = true;
+}
+
+// Write our entries to the older slot, at most once per save
+// period.  The sequence is cleared while writing, and set last.
+void checkSaveState(void)
+{
+  if (!stateDirty || stateFile == NULL || steady_clock::now() < nextSaveTime)
+    return;
+
+  StateSlot &slot = stateFile->slots[++stateSeq % 2];
+  slot.seq.store(0);
+  slot.count = numEntries;
+  memcpy(slot.entries, entries, numEntries * sizeof(StateEntry));
+  slot.checksum = stateChecksum(slot.entries, numEntries);
+  slot.seq.store(stateSeq, std::memory_order_release);
+
+  stateDirty = false;
+  nextSaveTime = steady_clock::now() + STATE_SAVE_PERIOD;
+}
+
+// Whether data received at a time was restored from our
+// snapshot, rather than received live.  Saved times are in
+// whole seconds, so we compare in those.
+bool isRestored(system_clock::time_point received)
+{
+  return system_clock::to_time_t(received) < system_clock::to_time_t(startTime);
+}
+
+// Replay our saved messages through the message handler,
+// with the time each was originally received
+void restoreState(void)
+{
+  mosquitto_message msg = {};
+
+  restoring = true;
+  for (uint32_t i = 0; i < numEntries; i++)
+  {
+    msg.topic = entries[i].topic;
+    msg.payload = entries[i].payload;
+    msg.payloadlen = entries[i].length;
+    messageTime = system_clock::from_time_t(entries[i].received);
+    mqttOnMessage(NULL, NULL, &msg);
+  }
+  restoring = false;
+
+  messageTime = system_clock::now();
+  _log("state: restored %d topics from snapshot", numEntries);
+}
@@ -0,0 +1,107 @@
+#include "statestore.h"
+#include "logger.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+StateStore stateStore;
+
+
+// Write a new value to a slot, and wake any sleeping panels
+void StateStore::publish(uint8_t slot, const char *value, size_t length,
+  system_clock::time_point received)
+{
+  if (slot >= STORE_MAX_SLOTS)
+    return;
+
+  if (length > STORE_VALUE_LEN) {
+    _warnLimited(std::chrono::minutes(1), "store: truncating %zu byte value", length);
+    length = STORE_VALUE_LEN;
+  }
+
+  StoreSlot &s = slots[slot];
+  uint32_t seq = s.seq.load(std::memory_order_relaxed);
+  uint32_t next = gen.load(std::memory_order_relaxed) + 1;
+
+  s.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (size_t i = 0; i < (length + 7) / 8; i++) {
+    uint64_t word = 0;
+    memcpy(&word, value + i * 8, std::min<size_t>(8, length - i * 8));
+    s.value[i].store(word, std::memory_order_relaxed);
+  }
+  s.length.store(length, std::memory_order_relaxed);
+  s.received.store(received.time_since_epoch().count(), std::memory_order_relaxed);
+  s.generation.store(next, std::memory_order_relaxed);
+
+  s.seq.store(seq + 2, std::memory_order_release);
+  gen.store(next, std::memory_order_release);
+
+  // Pairs with the fence in waitFor(): either a panel sees our
+  // generation before sleeping, or we see it waiting
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters.load(std::memory_order_relaxed))
+    wakeAll();
+}
+
+// Copy a slot's value as a string, returning the generation it
+// was written in (0 if the slot was never written)
+uint32_t StateStore::read(uint8_t slot, char *buffer, size_t size,
+  system_clock::time_point *received)
+{
+  if (slot >= STORE_MAX_SLOTS || size == 0)
+    return 0;
+
+  StoreSlot &s = slots[slot];
+  uint32_t before, after, generation;
+  size_t length;
+  int64_t time;
+
+  do {
+    before = s.seq.load(std::memory_order_acquire);
+    if (before & 1)
+      continue;
+
+    generation = s.generation.load(std::memory_order_relaxed);
+    length = std::min<size_t>(s.length.load(std::memory_order_relaxed), size - 1);
+    time = s.received.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < (length + 7) / 8; i++) {
+      uint64_t word = s.value[i].load(std::memory_order_relaxed);
+      memcpy(buffer + i * 8, &word, std::min<size_t>(8, length - i * 8));
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = s.seq.load(std::memory_order_relaxed);
+  } while ((before & 1) || before != after);
+
+  buffer[length] = '\0';
+  if (received)
+    *received = system_clock::time_point(system_clock::duration(time));
+  return generation;
+}
+
+// Sleep until the store changes from the generation we've seen,
+// the timeout passes or we're told to stop running
+void StateStore::waitFor(uint32_t seen, milliseconds timeout,
+  const std::atomic<bool> &running)
+{
+  std::unique_lock<std::mutex> lock(wakeMutex);
+  waiters.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  wake.wait_for(lock, timeout, [&]() {
+    return generation() != seen || !running.load(std::memory_order_relaxed);
+  });
+  waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Taking the lock here means a panel can't miss the wakeup
+// between checking its condition and going to sleep
+void StateStore::wakeAll()
+{
+  {
+    std::lock_guard<std::mutex> lock(wakeMutex);
+  }
+  wake.notify_all();
+}
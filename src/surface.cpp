@@ -0,0 +1,62 @@
+#include "surface.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+
+Surface::Surface(int w, int h) : sWidth(w), sHeight(h),
+  pixels(w * h * 3, 0), opaque(w * h, 0) {}
+
+// Set a pixel, clipping anything outside our bounds
+void Surface::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b)
+{
+  if (x < 0 || y < 0 || x >= sWidth || y >= sHeight)
+    return;
+
+  auto idx = y * sWidth + x;
+  pixels[3 * idx] = r;
+  pixels[3 * idx + 1] = g;
+  pixels[3 * idx + 2] = b;
+  opaque[idx] = 1;
+}
+
+// Clear to fully transparent
+void Surface::Clear()
+{
+  memset(pixels.data(), 0, pixels.size());
+  memset(opaque.data(), 0, opaque.size());
+}
+
+// Clear a region to fully transparent
+void Surface::clearRect(int x, int y, int w, int h)
+{
+  for (auto py = std::max(y, 0); py < std::min(y + h, sHeight); py++) {
+    for (auto px = std::max(x, 0); px < std::min(x + w, sWidth); px++)
+      opaque[py * sWidth + px] = 0;
+  }
+}
+
+// Fill the entire surface with an opaque color
+void Surface::Fill(uint8_t r, uint8_t g, uint8_t b)
+{
+  for (size_t i = 0; i < opaque.size(); i++) {
+    pixels[3 * i] = r;
+    pixels[3 * i + 1] = g;
+    pixels[3 * i + 2] = b;
+  }
+  memset(opaque.data(), 1, opaque.size());
+}
+
+// Save as a binary PPM image, transparent pixels are black
+bool Surface::writePPM(const char *path) const
+{
+  FILE *out = fopen(path, "wb");
+  if (out == NULL)
+    return false;
+
+  fprintf(out, "P6\n%d %d\n255\n", sWidth, sHeight);
+  bool ok = fwrite(pixels.data(), 1, pixels.size(), out) == pixels.size();
+  return (fclose(out) == 0) && ok;
+}
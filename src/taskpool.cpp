@@ -0,0 +1,47 @@
+#include "taskpool.h"
+#include "logger.h"
+
+TaskPool taskPool;
+
+
+void TaskPool::start(unsigned threads)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  stopping = false;
+  for (unsigned i = 0; i < threads; i++)
+    workers.emplace_back(&TaskPool::worker, this);
+  _debug("task pool started with %u threads", threads);
+}
+
+// Finish any queued tasks, then join our workers
+void TaskPool::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (workers.empty())
+      return;
+    stopping = true;
+  }
+  wake.notify_all();
+
+  for (auto &thread : workers)
+    thread.join();
+  workers.clear();
+}
+
+void TaskPool::worker()
+{
+  while (true)
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty())
+        return;
+      task = std::move(tasks.front());
+      tasks.pop();
+    }
+    task();
+  }
+}
@@ -0,0 +1,123 @@
+#include "terminal.h"
+#include "trace.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
+
+TerminalCanvas::TerminalCanvas(int w, int h) : tWidth(w), tHeight(h),
+  pixels(w * h * 3, 0), shown(w * h * 3, 0) {}
+
+void TerminalCanvas::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b)
+{
+  if (x < 0 || y < 0 || x >= tWidth || y >= tHeight)
+    return;
+
+  auto idx = 3 * (y * tWidth + x);
+  pixels[idx] = r;
+  pixels[idx + 1] = g;
+  pixels[idx + 2] = b;
+}
+
+void TerminalCanvas::Clear()
+{
+  Fill(0, 0, 0);
+}
+
+void TerminalCanvas::Fill(uint8_t r, uint8_t g, uint8_t b)
+{
+  for (size_t i = 0; i < pixels.size(); i += 3) {
+    pixels[i] = r;
+    pixels[i + 1] = g;
+    pixels[i + 2] = b;
+  }
+}
+
+// Write our escapes, retrying short writes
+void TerminalCanvas::write()
+{
+  size_t done = 0;
+  while (done < out.size())
+  {
+    ssize_t len = ::write(STDOUT_FILENO, out.data() + done, out.size() - done);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    done += len;
+  }
+  out.clear();
+}
+
+// Write the cells that changed since our last flush.  The
+// whole frame is written on the first, which also switches
+// to the alternate screen.
+void TerminalCanvas::flush()
+{
+  TRACE_SPAN("terminalFlush");
+  const uint8_t black[3] = {0, 0, 0};
+  char escape[48];
+  int32_t fg = -1, bg = -1;           // Colors set by our escapes
+  int row = -1, col = -1;             // Cursor position
+
+  if (!open)
+    out += TERMINAL_ENTER;
+
+  for (int cy = 0; cy < (tHeight + 1) / 2; cy++) {
+    for (int x = 0; x < tWidth; x++)
+    {
+      auto top = 3 * (2 * cy * tWidth + x);
+      auto bottom = top + 3 * tWidth;
+      bool hasBottom = (2 * cy + 1 < tHeight);
+
+      if (open && memcmp(&pixels[top], &shown[top], 3) == 0 &&
+          (!hasBottom || memcmp(&pixels[bottom], &shown[bottom], 3) == 0))
+        continue;
+
+      const uint8_t *upper = &pixels[top];
+      const uint8_t *lower = hasBottom ? &pixels[bottom] : black;
+      int32_t upperColor = (upper[0] << 16) | (upper[1] << 8) | upper[2];
+      int32_t lowerColor = (lower[0] << 16) | (lower[1] << 8) | lower[2];
+
+      if (row != cy || col != x) {
+        snprintf(escape, sizeof(escape), "\033[%d;%dH", cy + 1, x + 1);
+        out += escape;
+      }
+      if (upperColor != fg) {
+        snprintf(escape, sizeof(escape), "\033[38;2;%d;%d;%dm", upper[0], upper[1], upper[2]);
+        out += escape;
+        fg = upperColor;
+      }
+      if (lowerColor != bg) {
+        snprintf(escape, sizeof(escape), "\033[48;2;%d;%d;%dm", lower[0], lower[1], lower[2]);
+        out += escape;
+        bg = lowerColor;
+      }
+      out += TERMINAL_HALF_BLOCK;
+      row = cy;
+      col = x + 1;
+
+      memcpy(&shown[top], &pixels[top], 3);
+      if (hasBottom)
+        memcpy(&shown[bottom], &pixels[bottom], 3);
+    }
+  }
+
+  if (fg >= 0 || bg >= 0)
+    out += TERMINAL_RESET;
+  open = true;
+  write();
+}
+
+// Restore the terminal, back to the normal screen
+void TerminalCanvas::close()
+{
+  if (!open)
+    return;
+
+  out += TERMINAL_LEAVE;
+  write();
+  open = false;
+}
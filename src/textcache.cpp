@@ -0,0 +1,121 @@
+#include "textcache.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+
+bool TextRun::matches(const char *t, GirderFont *f, Color c,
+    uint8_t a, bool v)
+{
+  return (raster != NULL && font == f && align == a && vWidth == v &&
+    color.r == c.r && color.g == c.g && color.b == c.b && text == t);
+}
+
+// Lay out and render text into our raster in a single pass
+void TextRun::rasterize(const char *t, GirderFont *f, Color c,
+    uint8_t a, bool v)
+{
+  text = t;
+  font = f;
+  color = c;
+  align = a;
+  vWidth = v;
+
+  // Size the raster for the widest possible glyphs, only
+  // reallocating when the current one is too small
+  int w = text.size() * (font->width + 3) + 2 * TEXT_RASTER_PAD_X;
+  int h = font->height + TEXT_RASTER_DESCENT + 2 * TEXT_RASTER_PAD_Y;
+  if (raster == NULL || raster->width() < w || raster->height() < h) {
+    delete raster;
+    raster = new Surface(w, h);
+  } else {
+    raster->Clear();
+  }
+
+  renderLen = drawText(TEXT_RASTER_PAD_X, TEXT_RASTER_PAD_Y, color,
+      t, font, vWidth, false, raster);
+}
+
+// Copy our rendered text to a canvas, with (x,y)
+// matching the origin as used by drawText()
+void TextRun::blit(rgb_matrix::Canvas *target, int x, int y)
+{
+  if (raster == NULL)
+    return;
+
+  for (int sy = 0; sy < raster->height(); sy++) {
+    for (int sx = 0; sx < raster->width(); sx++) {
+      if (!raster->isOpaque(sx, sy))
+        continue;
+      auto rgb = raster->getPixel(sx, sy);
+      target->SetPixel(x + sx - TEXT_RASTER_PAD_X,
+          y + sy - TEXT_RASTER_PAD_Y, rgb[0], rgb[1], rgb[2]);
+    }
+  }
+}
+
+// Copy a horizontal window of our text to a canvas, the
+// columns [srcX, srcX + width) of the text are drawn at x
+void TextRun::blit(rgb_matrix::Canvas *target, int x, int y,
+    int srcX, int width)
+{
+  if (raster == NULL || width <= 0)
+    return;
+
+  int x0 = std::max(srcX + TEXT_RASTER_PAD_X, 0);
+  int x1 = std::min(srcX + TEXT_RASTER_PAD_X + width, raster->width());
+
+  for (int sy = 0; sy < raster->height(); sy++) {
+    for (int sx = x0; sx < x1; sx++) {
+      if (!raster->isOpaque(sx, sy))
+        continue;
+      auto rgb = raster->getPixel(sx, sy);
+      target->SetPixel(x + sx - srcX - TEXT_RASTER_PAD_X,
+          y + sy - TEXT_RASTER_PAD_Y, rgb[0], rgb[1], rgb[2]);
+    }
+  }
+}
+
+// Clear the pixels drawn by a previous blit() to black,
+// leaving any neighbouring pixels untouched
+void TextRun::erase(rgb_matrix::Canvas *target, int x, int y)
+{
+  if (raster == NULL)
+    return;
+
+  for (int sy = 0; sy < raster->height(); sy++) {
+    for (int sx = 0; sx < raster->width(); sx++) {
+      if (raster->isOpaque(sx, sy))
+        target->SetPixel(x + sx - TEXT_RASTER_PAD_X,
+            y + sy - TEXT_RASTER_PAD_Y, 0, 0, 0);
+    }
+  }
+}
+
+TextCache::~TextCache()
+{
+  for (auto &run : runs)
+    delete run.raster;
+}
+
+// Find a cached run, or rasterize into the least recently used entry
+TextRun* TextCache::lookup(const char *text, GirderFont *font,
+    Color color, uint8_t align, bool vWidth)
+{
+  TextRun *lru = &runs[0];
+
+  for (auto &run : runs)
+  {
+    if (run.matches(text, font, color, align, vWidth)) {
+      run.lastUsed = ++useCount;
+      return &run;
+    }
+    if (run.lastUsed < lru->lastUsed)
+      lru = &run;
+  }
+
+  lru->rasterize(text, font, color, align, vWidth);
+  lru->lastUsed = ++useCount;
+  return lru;
+}
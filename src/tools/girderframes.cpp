@@ -0,0 +1,242 @@
+// girderframes: save the frames smartgirder is showing, from
+// the ring of frames it publishes in shared memory
+//
+// usage: girderframes [-n count] [-o out] [-x scale] [-r fps] [path]
+//   -o    image to write (default frame.png), a name ending in
+//         .ppm writes a PPM.  With -n, a printf format for the
+//         frame number, eg. frame%04d.png
+//   -n    write each new frame, until this many (0 is no limit)
+//   -x    scale images up, so pixels are visible
+//   -r    write raw RGB video to stdout at a fixed rate, which
+//         repeats frames as needed, eg. for a recording:
+//         girderframes -r 30 | ffmpeg -f rawvideo -pix_fmt rgb24
+//             -s 128x64 -r 30 -i - sign.mp4
+//
+// Without -n or -r, the newest frame is saved.  We only read
+// the frames, smartgirder never waits for us.
+
+#include "frameexport.h"
+
+#include <png++/png.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FRAMES_POLL_PERIOD  5ms
+#define FRAMES_READ_TRIES   100
+#define FRAMES_OUT_LEN      512
+
+static volatile sig_atomic_t running = 1;
+
+static void stopRunning(int)
+{
+  running = 0;
+}
+
+// Copy a frame from its slot, failing if it is being written
+// or has been replaced by a newer frame since
+static bool readFrame(const FramesFileHeader *header, uint32_t number,
+    std::vector<uint8_t> &pixels)
+{
+  auto slot = (const FrameSlot *) ((const char *) header +
+      frameSlotOffset(header, (number - 1) % header->ring));
+
+  for (int i = 0; i < FRAMES_READ_TRIES; i++)
+  {
+    uint32_t seq = slot->seq.load(std::memory_order_acquire);
+    if (seq & 1)
+      continue;
+
+    uint32_t slotNumber = slot->number;
+    memcpy(pixels.data(), slot + 1, pixels.size());
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->seq.load(std::memory_order_relaxed) != seq)
+      continue;
+    return slotNumber == number;
+  }
+  return false;
+}
+
+// Wait for, and copy, a frame newer than the one we have
+static uint32_t nextFrame(const FramesFileHeader *header, uint32_t last,
+    std::vector<uint8_t> &pixels)
+{
+  while (running)
+  {
+    uint32_t latest = header->latest.load(std::memory_order_acquire);
+    if (latest != 0 && latest != last && readFrame(header, latest, pixels))
+      return latest;
+    std::this_thread::sleep_for(FRAMES_POLL_PERIOD);
+  }
+  return 0;
+}
+
+static bool writeImage(const char *path, const FramesFileHeader *header,
+    const std::vector<uint8_t> &pixels, int scale)
+{
+  int width = header->width, height = header->height;
+  size_t len = strlen(path);
+
+  if (len > 4 && strcmp(path + len - 4, ".ppm") == 0)
+  {
+    FILE *out = fopen(path, "wb");
+    if (out == NULL)
+      return false;
+
+    fprintf(out, "P6\n%d %d\n255\n", width * scale, height * scale);
+    std::vector<uint8_t> row(width * scale * 3);
+    for (int y = 0; y < height; y++)
+    {
+      for (int x = 0; x < width * scale; x++)
+        memcpy(&row[3 * x], &pixels[3 * (y * width + x / scale)], 3);
+      for (int i = 0; i < scale; i++)
+        fwrite(row.data(), 1, row.size(), out);
+    }
+    return fclose(out) == 0;
+  }
+
+  try {
+    png::image<png::rgb_pixel> image(width * scale, height * scale);
+    for (int y = 0; y < height * scale; y++) {
+      for (int x = 0; x < width * scale; x++) {
+        const uint8_t *rgb = &pixels[3 * ((y / scale) * width + x / scale)];
+        image.set_pixel(x, y, png::rgb_pixel(rgb[0], rgb[1], rgb[2]));
+      }
+    }
+    image.write(path);
+  } catch (std::exception &e) {
+    fprintf(stderr, "%s: %s\n", path, e.what());
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *out = "frame.png";
+  long count = -1;
+  int scale = 1, rate = 0, opt;
+
+  while ((opt = getopt(argc, argv, "o:n:x:r:")) != -1)
+  {
+    switch (opt) {
+    case 'o':
+      out = optarg;
+      break;
+    case 'n':
+      count = atol(optarg);
+      break;
+    case 'x':
+      scale = std::max(1, atoi(optarg));
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: girderframes [-n count] [-o out] [-x scale] [-r fps] [path]\n");
+      return 1;
+    }
+  }
+  const char *path = (optind < argc) ? argv[optind] : FRAMES_PATH;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(FramesFileHeader)) {
+    fprintf(stderr, "%s: not a smartgirder frames file\n", path);
+    return 1;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  auto header = (const FramesFileHeader *) map;
+
+  if (header->magic != FRAMES_MAGIC || header->version != FRAMES_VERSION ||
+      header->ring == 0 || header->slotSize < sizeof(FrameSlot) +
+        (size_t) header->width * header->height * 3 ||
+      (size_t) st.st_size < frameSlotOffset(header, header->ring))
+  {
+    fprintf(stderr, "%s: not a smartgirder frames file (or another version)\n", path);
+    return 1;
+  }
+
+  signal(SIGINT, stopRunning);
+  signal(SIGTERM, stopRunning);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<uint8_t> pixels((size_t) header->width * header->height * 3);
+  uint32_t number = 0;
+
+  // Video, at a steady rate from whatever frame is newest
+  if (rate > 0)
+  {
+    auto period = std::chrono::microseconds(1000000 / rate);
+    auto next = std::chrono::steady_clock::now();
+    number = nextFrame(header, 0, pixels);
+    while (running && number)
+    {
+      uint32_t latest = header->latest.load(std::memory_order_acquire);
+      if (latest != number && readFrame(header, latest, pixels))
+        number = latest;
+      if (fwrite(pixels.data(), 1, pixels.size(), stdout) != pixels.size())
+        break;
+
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+    return 0;
+  }
+
+  // The newest frame
+  if (count < 0)
+  {
+    if (nextFrame(header, 0, pixels) == 0)
+      return 1;
+    if (!writeImage(out, header, pixels, scale)) {
+      fprintf(stderr, "unable to write %s\n", out);
+      return 1;
+    }
+    fprintf(stderr, "wrote %dx%d frame to %s\n", header->width, header->height, out);
+    return 0;
+  }
+
+  // Each new frame, until we have enough
+  uint32_t written = 0, skipped = 0;
+  char name[FRAMES_OUT_LEN];
+  while (running && (count == 0 || written < count))
+  {
+    uint32_t latest = nextFrame(header, number, pixels);
+    if (latest == 0)
+      break;
+    if (number)
+      skipped += latest - number - 1;
+    number = latest;
+
+    snprintf(name, sizeof(name), out, written);
+    if (!writeImage(name, header, pixels, scale)) {
+      fprintf(stderr, "unable to write %s\n", name);
+      return 1;
+    }
+    written++;
+  }
+  fprintf(stderr, "wrote %u frames, missed %u\n", written, skipped);
+  return 0;
+}
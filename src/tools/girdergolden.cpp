@@ -0,0 +1,327 @@
+// girdergolden: render the dashboard through a script of states
+// offscreen, and compare each frame against a golden image
+//
+// usage: girdergolden [-u] [-k] [-d dir] [scene...]
+//   -u    update the golden images from the frames we render
+//   -d    directory of golden images (default golden), run
+//         from the top of the repo so icons and fonts are found
+//   -k    skip the checks if there is no golden directory, eg.
+//         off the device, rather than failing
+//
+// Frames that don't match are written to <dir>/failed, along with
+// a diff image: matching pixels are dimmed, differing ones red.
+// Scenes build on each other, so they are always all rendered;
+// naming scenes only limits which are compared.
+
+#include "dashboard.h"
+#include "display.h"
+#include "mqtt.h"
+#include "widgetmanager.h"
+#include "weatherwidget.h"
+#include "clock.h"
+#include "surface.h"
+#include "startup.h"
+#include "taskpool.h"
+#include "scheduler.h"
+#include "logger.h"
+
+#include <mosquitto.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#define GOLDEN_DIR          "golden"
+#define GOLDEN_FAILED_DIR   "failed"
+#define GOLDEN_SEED         1
+#define GOLDEN_TIME         1705311660    // Mon 1/15/2024 9:41 UTC
+#define SCENE_MAX_MESSAGES  12
+
+// Globals normally defined by the main program
+volatile bool girderRunning = true;
+bool forceRefresh = true;
+uint32_t cycle = 0;
+uint32_t refreshCycle = 0;
+
+extern std::map<weatherType, string> weatherCondNWS;
+
+struct SceneMessage
+{
+  const char *topic;
+  const char *payload;
+};
+
+struct Scene
+{
+  std::string name;
+  SceneMessage messages[SCENE_MAX_MESSAGES];
+  const char *sameAs = NULL;        // Scene whose frame we must match
+};
+
+// Scenes are rendered in order, each starting from the state
+// the previous ones left.  Weather types are added after these.
+static const Scene scenes[] = {
+  {"baseline", {
+    {WEATHER_SUN,         "above_horizon"},
+    {HASS_OUT_TEMP,       "72.3"},
+    {HASS_OUT_DEW,        "12.5"},
+    {HASS_OUT_PM25,       "4.2"},
+    {HASS_LR_TEMP,        "21.5"},
+    {HASS_LR_DEW,         "10.1"},
+    {PIWEATHER_MAX_WIND,  "5.2"},
+    {PIWEATHER_RAINFALL,  "0.0"},
+    {THERMOSTAT_STATE,    "off"},
+    {WEATHER_NOW_STATE,   "partlycloudy"},
+    {CALENDAR_EVENT,      "Dentist 3pm"},
+  }},
+  {"thermostat-heating",    {{THERMOSTAT_STATE, "heating"}}},
+  {"thermostat-cooling",    {{THERMOSTAT_STATE, "cooling"}}},
+  {"thermostat-idle-heat",  {{THERMOSTAT_STATE, "idle (heat)"}}},
+  {"thermostat-idle-cool",  {{THERMOSTAT_STATE, "idle (cool)"}}},
+  {"thermostat-fan",        {{THERMOSTAT_STATE, "fan_running"}}},
+  {"thermostat-off",        {{THERMOSTAT_STATE, "off"}}},
+  {"pm25-below-alert",      {{HASS_OUT_PM25, "19.9"}}},
+  {"pm25-alert",            {{HASS_OUT_PM25, "35.4"}}},
+  {"pm25-clear",            {{HASS_OUT_PM25, "4.2"}}},
+  {"temps-negative",        {{HASS_OUT_TEMP, "-8.4"}, {HASS_OUT_DEW, "-25.0"}}},
+  {"temps-wide",            {{HASS_OUT_TEMP, "104.9"}, {HASS_OUT_DEW, "26.7"},
+                             {HASS_LR_TEMP, "29.9"}, {PIWEATHER_MAX_WIND, "27.5"},
+                             {PIWEATHER_RAINFALL, "1.25"}}},
+  {"calendar-long",         {{CALENDAR_EVENT,
+    "Parent-teacher conference at the elementary school, room 114"}}},
+  {"alert-long",            {{WEATHER_ALERT,
+    "Winter Storm Warning in effect until 6PM Tuesday"}}},
+  {"alert-clear",           {{WEATHER_ALERT, ""}}},
+  {"night",                 {{WEATHER_SUN, "below_horizon"},
+                             {WEATHER_NOW_STATE, "partlycloudy"}}},
+  {"day",                   {{WEATHER_SUN, "above_horizon"},
+                             {WEATHER_NOW_STATE, "sunny"}}},
+  {"page-home",             {{HASS_LR_VOC, "112"}, {HASS_GARAGE, "open"},
+                             {HASS_CHORES, "Take out recycling\nWater plants"},
+                             {DEBUG_PAGE, "home"}}},
+  {"page-home-alert",       {{HASS_LR_VOC, "310"}, {HASS_GARAGE, "closed"}}},
+  {"page-main",             {{DEBUG_PAGE, "main"}}, "day"},
+};
+
+// The forecast replaces the current weather for a while, so
+// it's shown last
+static const Scene forecastScene =
+  {"forecast", {{WEATHER_FC_STATE, "rainy"}, {WEATHER_FC_TEMP, "65/48"}}};
+
+
+static void send(const char *topic, const char *payload)
+{
+  struct mosquitto_message message = {};
+  message.topic = (char *) topic;
+  message.payload = (void *) payload;
+  message.payloadlen = strlen(payload);
+  mqttOnMessage(NULL, NULL, &message);
+}
+
+static bool readPPM(const char *path, int &width, int &height,
+    std::vector<uint8_t> &pixels)
+{
+  FILE *in = fopen(path, "rb");
+  if (in == NULL)
+    return false;
+
+  int maxval;
+  bool ok = fscanf(in, "P6 %d %d %d", &width, &height, &maxval) == 3 &&
+      maxval == 255 && fgetc(in) != EOF && width > 0 && height > 0;
+  if (ok) {
+    pixels.resize(width * height * 3);
+    ok = fread(pixels.data(), 1, pixels.size(), in) == pixels.size();
+  }
+  fclose(in);
+  return ok;
+}
+
+// Write an image of the differences between a frame and its
+// golden image, returning the number of pixels that differ
+static uint32_t writeDiff(const char *path, const Surface &frame,
+    const std::vector<uint8_t> &golden)
+{
+  Surface diff(frame.width(), frame.height());
+  uint32_t count = 0;
+
+  for (int y = 0; y < frame.height(); y++) {
+    for (int x = 0; x < frame.width(); x++)
+    {
+      const uint8_t *actual = frame.getPixel(x, y);
+      const uint8_t *expected = &golden[3 * (y * frame.width() + x)];
+
+      if (memcmp(actual, expected, 3) == 0) {
+        uint8_t grey = (expected[0] + expected[1] + expected[2]) / 12;
+        diff.SetPixel(x, y, grey, grey, grey);
+      } else {
+        diff.SetPixel(x, y, 255, 0, 0);
+        count++;
+      }
+    }
+  }
+
+  diff.writePPM(path);
+  return count;
+}
+
+// Compare a frame to its golden image, saving it (and a
+// diff) to the failed directory if it doesn't match
+static bool checkFrame(const std::string &dir, const std::string &name,
+    const Surface &frame)
+{
+  std::string golden = dir + "/" + name + ".ppm";
+  std::string failed = dir + "/" GOLDEN_FAILED_DIR "/" + name;
+  std::vector<uint8_t> pixels;
+  int width, height;
+
+  if (!readPPM(golden.c_str(), width, height, pixels)) {
+    fprintf(stderr, "%-24s MISSING  %s\n", name.c_str(), golden.c_str());
+    return false;
+  }
+
+  bool sizeMatches = (width == frame.width() && height == frame.height());
+  if (sizeMatches && memcmp(pixels.data(), frame.getPixel(0, 0), pixels.size()) == 0) {
+    fprintf(stderr, "%-24s ok\n", name.c_str());
+    return true;
+  }
+
+  mkdir((dir + "/" GOLDEN_FAILED_DIR).c_str(), 0755);
+  frame.writePPM((failed + ".ppm").c_str());
+  if (!sizeMatches) {
+    fprintf(stderr, "%-24s FAIL     golden is %dx%d, frame is %dx%d\n",
+        name.c_str(), width, height, frame.width(), frame.height());
+    return false;
+  }
+
+  uint32_t count = writeDiff((failed + ".diff.ppm").c_str(), frame, pixels);
+  fprintf(stderr, "%-24s FAIL     %u pixels differ, see %s.diff.ppm\n",
+      name.c_str(), count, failed.c_str());
+  return false;
+}
+
+int main(int argc, char *argv[])
+{
+  std::string dir = GOLDEN_DIR;
+  bool update = false, skipMissing = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ukd:")) != -1)
+  {
+    switch (opt) {
+    case 'u':
+      update = true;
+      break;
+    case 'k':
+      skipMissing = true;
+      break;
+    case 'd':
+      dir = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: girdergolden [-u] [-k] [-d dir] [scene...]\n");
+      return 1;
+    }
+  }
+
+  // Golden images are made on the device, so its fonts and
+  // icons are used.  Without any, nothing can be compared,
+  // which fails unless we were asked to skip.
+  struct stat st;
+  if (!update && stat(dir.c_str(), &st) != 0) {
+    fprintf(stderr, "no golden images in %s/, %s (create them with "
+        "'make golden-update' on the device)\n", dir.c_str(),
+        skipMissing ? "skipping checks" : "failing");
+    return skipMissing ? 0 : 1;
+  }
+
+  // Logging is only useful when something fails to load
+  if (freopen("/dev/null", "w", stdout) == NULL) {
+    perror("/dev/null");
+    return 1;
+  }
+
+  // Make everything time or randomness dependent reproducible
+  setenv("TZ", "UTC", 1);
+  tzset();
+  animationSeed = GOLDEN_SEED;
+  srand(GOLDEN_SEED);
+  clockRenderer.setFixedTime(system_clock::from_time_t(GOLDEN_TIME));
+  animScheduler.setFrameBudget(std::chrono::seconds(1));
+
+  // One scene per condition, some are shared by day and night types
+  std::vector<Scene> script(std::begin(scenes), std::end(scenes));
+  std::set<string> conditions;
+  for (const auto &it : weatherCondNWS) {
+    if (conditions.insert(it.second).second)
+      script.push_back({"weather-" + it.second, {{WEATHER_NOW_STATE, it.second.c_str()}}});
+  }
+  script.push_back(forecastScene);
+
+  taskPool.start();
+  Surface frame(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+  setupOffscreenDisplay(&frame);
+  setupDashboard();
+  waitForFonts();
+
+  if (update)
+    mkdir(dir.c_str(), 0755);
+
+  auto start = steady_clock::now();
+  uint32_t checked = 0, failures = 0;
+  size_t frameSize = (size_t) frame.width() * frame.height() * 3;
+  std::map<string, std::vector<uint8_t>> frames;
+
+  for (const auto &scene : script)
+  {
+    for (auto &msg : scene.messages) {
+      if (msg.topic)
+        send(msg.topic, msg.payload);
+    }
+    cycle++;
+    renderFrame();
+
+    // Kept for later scenes that must match this one
+    const uint8_t *pixels = frame.getPixel(0, 0);
+    frames[scene.name].assign(pixels, pixels + frameSize);
+
+    bool selected = (optind == argc);
+    for (int i = optind; i < argc; i++)
+      selected |= (scene.name == argv[i]);
+    if (!selected)
+      continue;
+
+    checked++;
+    if (scene.sameAs && frames[scene.sameAs] != frames[scene.name]) {
+      fprintf(stderr, "%-24s FAIL     frame differs from %s\n",
+          scene.name.c_str(), scene.sameAs);
+      failures++;
+    }
+    else if (update) {
+      std::string path = dir + "/" + scene.name + ".ppm";
+      if (!frame.writePPM(path.c_str())) {
+        fprintf(stderr, "unable to write %s\n", path.c_str());
+        failures++;
+      }
+    }
+    else if (!checkFrame(dir, scene.name, frame))
+      failures++;
+  }
+
+  taskPool.stop();
+
+  double elapsed = std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+  if (update)
+    fprintf(stderr, "wrote %u golden frames to %s/ in %.0f ms\n", checked - failures,
+        dir.c_str(), elapsed);
+  else
+    fprintf(stderr, "%u of %u frames match in %.0f ms\n", checked - failures, checked, elapsed);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+// girderlog: print the circular smartgirder log in order
+//
+// usage: girderlog [-f] [path]
+//   -f    follow, printing new lines as they are written
+
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <vector>
+
+#define FOLLOW_POLL_US    200000
+
+// Copy log data between two head positions, which
+// may wrap around the end of the buffer
+static void copyRange(const char *data, uint32_t capacity,
+    uint32_t from, uint32_t to, std::vector<char> &out)
+{
+  out.clear();
+  for (uint32_t pos = from; pos != to; ) {
+    uint32_t offset = pos & (capacity - 1);
+    uint32_t len = std::min(to - pos, capacity - offset);
+    out.insert(out.end(), data + offset, data + offset + len);
+    pos += len;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  bool follow = false;
+  const char *path = LOG_PATH;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-f") == 0)
+      follow = true;
+    else
+      path = argv[i];
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(LogFileHeader)) {
+    fprintf(stderr, "%s: not a smartgirder log\n", path);
+    return 1;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  auto header = (const LogFileHeader *) map;
+  if (header->magic != LOG_FILE_MAGIC || header->version != LOG_FILE_VERSION ||
+      header->headerSize + (size_t) header->capacity > (size_t) st.st_size) {
+    fprintf(stderr, "%s: unsupported log format\n", path);
+    return 1;
+  }
+
+  const char *data = (const char *) map + header->headerSize;
+  uint32_t capacity = header->capacity;
+  std::vector<char> buffer;
+
+  // Start from the oldest data still in the buffer
+  uint32_t head = header->head.load(std::memory_order_acquire);
+  uint32_t from = header->wrapped.load() ? head - capacity : 0;
+  bool partial = header->wrapped.load();
+
+  while (true)
+  {
+    copyRange(data, capacity, from, head, buffer);
+
+    // Anything overwritten while we copied is invalid,
+    // skip to the first complete line after it
+    uint32_t after = header->head.load(std::memory_order_acquire);
+    size_t skip = 0;
+    if (after - from > capacity) {
+      skip = std::min((size_t) (after - capacity - from), buffer.size());
+      partial = true;
+    }
+    if (partial) {
+      while (skip < buffer.size() && buffer[skip++] != '\n');
+      partial = false;
+    }
+
+    fwrite(buffer.data() + skip, 1, buffer.size() - skip, stdout);
+    fflush(stdout);
+
+    if (!follow)
+      break;
+
+    // Wait for new data
+    from = head;
+    while ((head = header->head.load(std::memory_order_acquire)) == from)
+      usleep(FOLLOW_POLL_US);
+
+    // We fell behind by more than the buffer
+    if (head - from > capacity) {
+      from = head - capacity;
+      partial = true;
+    }
+  }
+
+  munmap(map, st.st_size);
+  close(fd);
+  return 0;
+}
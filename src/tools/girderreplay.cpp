@@ -0,0 +1,198 @@
+// girderreplay: feed a capture of MQTT messages back through the
+// dashboard, rendering offscreen, and report how long it took
+//
+// usage: girderreplay [-s speed] [-o frame.ppm] [-v] capture
+//   -s    playback speed: 1 for real time (default), N for N times
+//         faster, or 0 to replay as fast as possible
+//   -o    write the final frame to a PPM image
+//   -v    show log messages
+//
+// Record a capture on the device by publishing "on" (or a file
+// name, created in /dev/shm) to debug/capture, and "off" when
+// done.  Captures stop by themselves at 8MB.  Widget timers
+// (eg. animations, scrolling) run in real time, so at high
+// speeds they advance less between messages than on the device.
+
+#include "capture.h"
+#include "dashboard.h"
+#include "display.h"
+#include "mqtt.h"
+#include "widgetmanager.h"
+#include "clock.h"
+#include "surface.h"
+#include "startup.h"
+#include "taskpool.h"
+#include "logger.h"
+
+#include <mosquitto.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::chrono::microseconds;
+
+// Globals normally defined by the main program
+volatile bool girderRunning = true;
+bool forceRefresh = true;
+uint32_t cycle = 0;
+uint32_t refreshCycle = 0;
+
+extern WidgetManager widgets;
+
+static uint32_t frames = 0;
+
+
+static void handleSignal(int signal)
+{
+  girderRunning = false;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: girderreplay [-s speed] [-o frame.ppm] [-v] capture\n");
+}
+
+static void drawFrame(void)
+{
+  cycle++;
+  renderFrame();
+  frames++;
+}
+
+// Keep drawing frames as the main loop would, until a
+// message is due
+static void waitUntil(steady_clock::time_point due)
+{
+  for (auto now = steady_clock::now(); now < due && girderRunning;
+      now = steady_clock::now())
+  {
+    auto wait = std::min({std::chrono::ceil<milliseconds>(due - now),
+        widgets.nextUpdateIn(), clockRenderer.nextUpdateIn()});
+    std::this_thread::sleep_for(wait);
+    drawFrame();
+  }
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+  if (sorted.empty())
+    return 0;
+  return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+int main(int argc, char *argv[])
+{
+  double speed = 1;
+  const char *framePath = NULL;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:o:v")) != -1)
+  {
+    switch (opt) {
+    case 's':
+      speed = atof(optarg);
+      break;
+    case 'o':
+      framePath = optarg;
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+  if (optind != argc - 1 || speed < 0) {
+    usage();
+    return 1;
+  }
+
+  // Our report goes to stderr, logging to stdout
+  if (!verbose && freopen("/dev/null", "w", stdout) == NULL) {
+    perror("/dev/null");
+    return 1;
+  }
+
+  CaptureReader reader;
+  if (!reader.open(argv[optind])) {
+    fprintf(stderr, "unable to read capture %s\n", argv[optind]);
+    return 1;
+  }
+
+  signal(SIGINT, handleSignal);
+  taskPool.start();
+
+  Surface frame(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+  setupOffscreenDisplay(&frame);
+  setupDashboard();
+  waitForFonts();
+  drawFrame();
+
+  CaptureMessage msg;
+  std::vector<double> latencies;
+  std::string slowestTopic;
+  double slowest = -1;
+  uint32_t lastTime = 0;
+  auto replayStart = steady_clock::now();
+
+  while (girderRunning && reader.next(msg))
+  {
+    if (speed > 0)
+      waitUntil(replayStart + microseconds((int64_t) ((int64_t) msg.time * 1000 / speed)));
+
+    // Dispatched as if received from the broker
+    struct mosquitto_message message = {};
+    msg.payload.push_back('\0');
+    message.topic = msg.topic.data();
+    message.payload = msg.payload.data();
+    message.payloadlen = msg.payload.size() - 1;
+
+    auto start = steady_clock::now();
+    mqttOnMessage(NULL, NULL, &message);
+    drawFrame();
+    double latency = std::chrono::duration<double, std::micro>(
+        steady_clock::now() - start).count();
+
+    if (latency > slowest) {
+      slowest = latency;
+      slowestTopic = msg.topic;
+    }
+    latencies.push_back(latency);
+    lastTime = msg.time;
+  }
+
+  double elapsed = std::chrono::duration<double>(steady_clock::now() - replayStart).count();
+  double total = 0;
+  for (auto l : latencies)
+    total += l;
+  std::sort(latencies.begin(), latencies.end());
+
+  fprintf(stderr, "replayed %zu messages in %.3fs, captured over %.3fs (%.1fx)\n",
+      latencies.size(), elapsed, lastTime / 1000.0,
+      elapsed > 0 ? lastTime / 1000.0 / elapsed : 0);
+  fprintf(stderr, "throughput: %.0f messages/s, %u frames\n",
+      elapsed > 0 ? latencies.size() / elapsed : 0, frames);
+  if (!latencies.empty())
+    fprintf(stderr, "latency (us): avg %.1f, p50 %.1f, p99 %.1f, max %.1f (%s)\n",
+        total / latencies.size(), percentile(latencies, 0.5),
+        percentile(latencies, 0.99), latencies.back(), slowestTopic.c_str());
+
+  if (framePath) {
+    if (frame.writePPM(framePath))
+      fprintf(stderr, "final frame written to %s\n", framePath);
+    else
+      fprintf(stderr, "unable to write frame to %s\n", framePath);
+  }
+
+  taskPool.stop();
+  return 0;
+}
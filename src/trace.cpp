@@ -0,0 +1,134 @@
+#include "trace.h"
+#include "logger.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> traceEnabled{TRACE_DEFAULT_ENABLED};
+
+// Ring of recent events for a single thread.  Only the owning
+// thread writes events; count is published after each event so
+// a dump from another thread can tell which events are complete.
+struct TraceBuffer
+{
+  uint32_t tid;
+  std::atomic<uint32_t> count{0};
+  TraceEvent events[TRACE_BUFFER_EVENTS];
+};
+
+static std::mutex traceMutex;
+static std::vector<TraceBuffer *> traceBuffers;
+static thread_local TraceBuffer *localBuffer = NULL;
+static std::atomic<bool> dumpRequested{false};
+
+void setTraceEnabled(bool enabled)
+{
+  traceEnabled = enabled;
+  _log("tracing %s", enabled ? "enabled" : "disabled");
+}
+
+// Safe to call from a signal handler, the dump
+// itself is done from the main loop
+void requestTraceDump(void)
+{
+  dumpRequested = true;
+}
+
+void checkTraceDump(void)
+{
+  if (dumpRequested.exchange(false))
+    traceDump();
+}
+
+void traceRecord(const char *name, const char *arg, uint64_t start, uint64_t end)
+{
+  // Buffers are allocated on the first event from each thread
+  if (localBuffer == NULL)
+  {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    localBuffer = new TraceBuffer;
+    localBuffer->tid = traceBuffers.size() + 1;
+    traceBuffers.push_back(localBuffer);
+  }
+
+  uint32_t n = localBuffer->count.load(std::memory_order_relaxed);
+  TraceEvent *event = &localBuffer->events[n & (TRACE_BUFFER_EVENTS - 1)];
+  event->name = name;
+  event->arg = arg;
+  event->start = start;
+  event->duration = (end - start > UINT32_MAX) ? UINT32_MAX : end - start;
+  localBuffer->count.store(n + 1, std::memory_order_release);
+}
+
+// Write a string to our JSON output, escaping as needed
+static void writeJSONString(FILE *out, const char *str)
+{
+  fputc('"', out);
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\')
+      fputc('\\', out);
+    if ((unsigned char) *str >= 0x20)
+      fputc(*str, out);
+  }
+  fputc('"', out);
+}
+
+// Write the events from all threads as Chrome trace JSON.  Events
+// a thread overwrites while we copy its buffer are discarded.
+bool traceDump(const char *path)
+{
+  std::vector<TraceEvent> events;
+  std::vector<uint32_t> tids;
+
+  {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    for (auto buffer : traceBuffers)
+    {
+      uint32_t count = buffer->count.load(std::memory_order_acquire);
+      uint32_t first = (count > TRACE_BUFFER_EVENTS) ? count - TRACE_BUFFER_EVENTS : 0;
+      size_t base = events.size();
+
+      for (uint32_t i = first; i < count; i++) {
+        events.push_back(buffer->events[i & (TRACE_BUFFER_EVENTS - 1)]);
+        tids.push_back(buffer->tid);
+      }
+
+      // Events overwritten while we copied are stale, as is the
+      // slot of an event being written (index after), unpublished
+      uint32_t after = buffer->count.load(std::memory_order_acquire);
+      if (after - first >= TRACE_BUFFER_EVENTS) {
+        size_t stale = std::min<size_t>(after + 1 - TRACE_BUFFER_EVENTS - first, count - first);
+        events.erase(events.begin() + base, events.begin() + base + stale);
+        tids.erase(tids.begin() + base, tids.begin() + base + stale);
+      }
+    }
+  }
+
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    _error("unable to write trace to %s", path);
+    return false;
+  }
+
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    fprintf(out, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+        i ? ",\n" : "", tids[i], events[i].start / 1000.0, events[i].duration / 1000.0);
+    writeJSONString(out, events[i].name);
+    if (events[i].arg) {
+      fprintf(out, ",\"args\":{\"arg\":");
+      writeJSONString(out, events[i].arg);
+      fputc('}', out);
+    }
+    fputc('}', out);
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+
+  _log("trace: wrote %zu events to %s", events.size(), path);
+  return true;
+}
@@ -20,6 +20,8 @@ Raindrop Palette Colors:
   565656
 */
 
+uint32_t animationSeed = 0;
+
 // Calculate offset into an RGB 8-bit raw image buffer
 uint16_t imgIndex(uint8_t x, uint8_t y, uint8_t width) {
   return 3 * (y * width + x);
@@ -32,7 +34,7 @@ rgb_matrix::Color getRandomColor(std::vector<string> colors)
   uint32_t colorNum;
 
   std::random_device rd;
-  std::mt19937 gen(rd());
+  std::mt19937 gen(animationSeed ? animationSeed : rd());
   std::uniform_int_distribution<> distrib(0, colors.size()-1);
 
   auto idx = distrib(gen);
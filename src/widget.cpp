@@ -4,12 +4,16 @@
 #include "widget.h"
 #include "logger.h"
 #include "icons.h"
+#include "widgetmanager.h"
+#include "trace.h"
+#include "state.h"
+#include "iconcache.h"
 
 #include <chrono>
 #include <cstring>
 #include <algorithm>
+#include <climits>
 
-#include <sys/stat.h>
 #include <stdio.h>
 
 #include <led-matrix.h>
@@ -26,8 +30,7 @@ extern bool daytime;
 extern uint8_t brightness;
 extern uint8_t boldBrightnessIncrease;
 extern uint32_t cycle;
-extern rgb_matrix::RGBMatrix *matrix;
-extern rgb_matrix::Color colorDarkGrey, colorBlack;
+extern rgb_matrix::Color colorDarkGrey, colorBlack, colorTextDark;
 extern GirderFont *defaultFont;
 
 
@@ -50,6 +53,16 @@ char* tempC2FHelper(char *payload)
   return buffer;
 }
 
+// Show received temperature as an integer, with degree symbol
+char* tempDegreeHelper(char *payload)
+{
+  char *buffer = new char[WIDGET_TEXT_LEN];
+
+  snprintf(buffer, WIDGET_TEXT_LEN, "%d%c", int(atof(payload)), 176);
+
+  return buffer;
+}
+
 // Limit string length of displayed value
 // (if 10 or greater, just show integer value)
 char* floatStrLen(char *payload)
@@ -109,6 +122,13 @@ uint16_t DashboardWidget::_getIconSize() {
   return (iWidth * iHeight);
 }
 
+// (Re)allocate our surface to match the widget size
+void DashboardWidget::_allocSurface()
+{
+  delete surface;
+  surface = new Surface(width, height + 1 + WIDGET_SURFACE_MARGIN);
+}
+
 /*
   ----==== [ Configuration Functions ] ====----
 */
@@ -117,9 +137,70 @@ void DashboardWidget::setDebug(bool value) {
   debug = value;
 }
 
-// Set/clear active flag for widget
-void DashboardWidget::setActive(bool value) {
+// Set/clear active flag for widget, recompositing our
+// bounds to show or hide our (cached) surface
+void DashboardWidget::setActive(bool value)
+{
+  if (value == active)
+    return;
+
   active = value;
+  present();
+}
+
+bool DashboardWidget::isActive() {
+  return active;
+}
+
+// Set stacking order, widgets with a higher value are on top
+void DashboardWidget::setZOrder(uint8_t z) {
+  zOrder = z;
+}
+
+uint8_t DashboardWidget::getZOrder() {
+  return zOrder;
+}
+
+bool DashboardWidget::isVisible() {
+  return visible;
+}
+
+// Set/clear visible flag, called from WidgetManager when
+// a widget is shown, hidden or occluded by another widget
+void DashboardWidget::setVisible(bool value) {
+  visible = value;
+}
+
+// Check if our bounds fully cover another widget's bounds
+bool DashboardWidget::covers(DashboardWidget *other)
+{
+  return (widgetX <= other->widgetX && widgetY <= other->widgetY &&
+    widgetX + width >= other->widgetX + other->width &&
+    widgetY + height >= other->widgetY + other->height);
+}
+
+// Set the manager responsible for compositing this widget
+void DashboardWidget::setManager(WidgetManager *wManager) {
+  manager = wManager;
+}
+
+Surface* DashboardWidget::getSurface() {
+  return surface;
+}
+
+uint8_t DashboardWidget::getX() {
+  return widgetX;
+}
+
+uint8_t DashboardWidget::getY() {
+  return widgetY;
+}
+
+// Check if a (frame) coordinate lies within our surface
+bool DashboardWidget::contains(int x, int y)
+{
+  return (surface != NULL && x >= widgetX && y >= widgetY &&
+    x < widgetX + surface->width() && y < widgetY + surface->height());
 }
 
 // Set widget origin
@@ -149,7 +230,10 @@ void DashboardWidget::setSize(widgetSizeType wsize)
       break;
     default:
       _error("unknown widget size %s, not configuring");
+      return;
   }
+
+  _allocSurface();
 }
 
 // Set bounds for widget rendering box
@@ -157,6 +241,7 @@ void DashboardWidget::setSize(widgetSizeType wsize)
 void DashboardWidget::setBounds(uint8_t w, uint8_t h) {
   width = w;
   height = h;
+  _allocSurface();
 }
 
 /* ----==== [ Text Functions ] ====---- */
@@ -171,6 +256,7 @@ void DashboardWidget::setText(char *text)
 {
   _debug("widget %s: setting text to: %s", name, text);
   strncpy(tData, text, WIDGET_TEXT_LEN);
+  tScrollReset = true;
 }
 
 // Set custom font
@@ -261,6 +347,28 @@ void DashboardWidget::setAlertLevel(float alertLevel, rgb_matrix::Color alertCol
   tAlertColor = alertColor;
 }
 
+// Enable/disable scrolling (marquee) of text
+// that is too long to fit within the widget
+void DashboardWidget::setScrollText(bool scroll)
+{
+  tScroll = scroll;
+  tScrollReset = true;
+}
+
+// Set the time per 1px scroll step
+void DashboardWidget::setScrollPeriod(milliseconds period)
+{
+  if (period < 1ms)
+    period = 1ms;
+  tScrollPeriod = period;
+}
+
+// Check if text is scrolling and has not yet completed a pass
+bool DashboardWidget::scrollPending()
+{
+  return (tScrolling && tScrollCount == 0);
+}
+
 void DashboardWidget::setTextColor(rgb_matrix::Color newTextColor)
 {
   tColor = newTextColor;
@@ -269,6 +377,11 @@ void DashboardWidget::setTextColor(rgb_matrix::Color newTextColor)
 // Update text and set temporary bold brightness
 void DashboardWidget::updateText(char *text, bool brighten)
 {
+  // Track the age of our data, even if unchanged
+  dataTime = messageTime;
+  checkStale();
+  recordHistory(text);
+
   // Abbreviate zero/null floating-point values
   if (strcmp(text, "0.0") == 0)
     text = (char *) "--";
@@ -285,12 +398,14 @@ void DashboardWidget::updateText(char *text, bool brighten)
     milliseconds(refreshDelay));
 
   setText(text);
-  if (brighten) {
+
+  // Only highlight new data, not values restored at startup
+  if (brighten && system_clock::now() - dataTime < refreshDelay) {
     resetTime = system_clock::now() + refreshDelay;
     tempAdjustBrightness(boldBrightnessIncrease, BRIGHT_TEXT);
   }
 
-  render();
+  markDirty();
 }
 
 // Update text with helper, then update same as above
@@ -301,7 +416,28 @@ void DashboardWidget::updateText(char *data, char*(helperFunc)(char*), bool brig
   // Dual-copy used here to prevent dupication of logic
   char *updatedText = helperFunc(data);
   updateText(updatedText, brighten);
-  free(updatedText);
+  delete[] updatedText;
+}
+
+// Keep a history of our values, eg. for trends
+void DashboardWidget::trackHistory() {
+  history = findHistory(name);
+}
+
+SensorHistory* DashboardWidget::getHistory() {
+  return history;
+}
+
+// Record our (numeric) text in our history, as shown
+void DashboardWidget::recordHistory(const char *text)
+{
+  if (history == NULL)
+    return;
+
+  char *end;
+  float value = strtof(text, &end);
+  if (end != text)
+    history->add(dataTime, value);
 }
 
 /* ----==== [ Icon Functions ] ====---- */
@@ -351,43 +487,35 @@ void DashboardWidget::setIconImage(uint8_t w, uint8_t h, const uint8_t *img)
 // Set widget icon and size from a PNG image
 void DashboardWidget::setIconImage(uint8_t w, uint8_t h, const char* iconFile)
 {
-  png::image<png::rgb_pixel> image;
-
-  struct stat buffer;
-  if (stat(iconFile, &buffer) == 0) {
-    image.read(iconFile);
-  } else {
+  const IconImage *icon = loadIcon(iconFile);
+  if (icon == NULL) {
     _error("image %s not found, using default", iconFile);
-    image.read("icons/clouds_unknown-1.0.png");
+    icon = loadIcon(ICON_WEATHER_UNKNOWN);
+    if (icon == NULL)
+      return;
   }
 
-  if (w > image.get_width() || h > image.get_height()) {
+  if (w > icon->width || h > icon->height) {
     _error("setIconImage() dimension arguments larger then image size, aborting");
     return;
   }
-  if (w != image.get_width() || h != image.get_height()) {
+  if (w != icon->width || h != icon->height) {
     _warn("setIconImage() dimensions smaller then image size, rendering may not match");
   }
 
   // Allocate storage for new image format
   // TODO: Free old image?
   uint8_t *newImg = (uint8_t *)malloc(w * h * 3 * sizeof(uint8_t));
-  uint16_t idx = 0;
 
   if (newImg == NULL) {
     _error("unable to allocate buffer for icon, aborting");
     return;
   }
 
-  // Convert PNG pixel data to a RGB pixel array
-  for (size_t y = 0; y < h; y++) {
-    for (size_t x = 0; x < w; x++) {
-      png::rgb_pixel pixel = image.get_pixel(x, y);
-      newImg[idx++] = pixel.red;
-      newImg[idx++] = pixel.green;
-      newImg[idx++] = pixel.blue;
-    }
-  }
+  // Copy rows from the decoded image, our copy may be
+  // modified (eg. by animations) so can't be shared
+  for (size_t y = 0; y < h; y++)
+    memcpy(newImg + y * w * 3, icon->pixels + y * icon->width * 3, w * 3);
 
   setIconImage(w, h, newImg);
 }
@@ -402,7 +530,7 @@ void DashboardWidget::updateIcon(const char *data, const char* (helperFunc)(char
   _debug("setting icon to %s", iData);
 
   setIconImage(iWidth, iHeight, helperFunc(iData));
-  render();
+  markDirty();
 }
 
 // Update icon
@@ -415,33 +543,68 @@ void DashboardWidget::updateIcon(std::string data)
   _debug("setting icon to %s", iData);
 
   setIconImage(iWidth, iHeight, iData);
-  render();
+  markDirty();
 }
 
 /*
   ----==== [ Rendering Functions ] ====----
 */
 
-// Clear the rendering bounds of our widget
-void DashboardWidget::clear(bool force)
+// Clear our surface, leaving the widget bounds filled with
+// an opaque background and the margin below transparent
+void DashboardWidget::clear()
 {
-  // If we are inactive and no force-clear set then return
-  if (!active && !force)
+  if (surface == NULL)
     return;
 
+  surface->Clear();
   // if (debug)
-  //   drawRect(widgetX, widgetY, width, height, colorDarkGrey);
+  //   drawRect(0, 0, width, height, colorDarkGrey, surface);
   // else
-  drawRect(widgetX, widgetY, width, height+1, colorBlack);
+  drawRect(0, 0, width, height+1, colorBlack, surface);
+}
+
+// Flag the widget to be rendered on the next frame, so
+// several updates in a burst of messages render once
+void DashboardWidget::markDirty() {
+  dirty = true;
+}
+
+bool DashboardWidget::isDirty() {
+  return dirty;
 }
 
-// Render our widget
+// Check if we have shown any received (or restored) data
+bool DashboardWidget::hasData() {
+  return dataTime != system_clock::time_point();
+}
+
+// Check if our data was restored from the snapshot and not
+// yet replaced by a live message, and redraw if this changed.
+// Widgets with no received data aren't stale.
+void DashboardWidget::checkStale()
+{
+  bool old = (hasData() && isRestored(dataTime));
+
+  if (old != stale) {
+    stale = old;
+    markDirty();
+  }
+}
+
+// Render our widget into its surface, then composite it
+// to the display.  This is done even while inactive, so our
+// surface is current whenever we are shown again.
 // TODO: Break clear widget logic into text and icon-specific
 // sections and move to those rendering functions
 void DashboardWidget::render()
 {
-  if (!active)
+  TRACE_SPAN_ARG("render", name);
+  dirty = false;
+  if (surface == NULL) {
+    _error("render(%s) called without size, aborting", name);
     return;
+  }
 
   // Clear widget
   // _debug("clearing widget %s", name);
@@ -455,34 +618,84 @@ void DashboardWidget::render()
   // Calculated from icon height & fixed width
   if (debug)
   {
-    matrix->SetPixel(widgetX, widgetY, 255,0,0);
-    matrix->SetPixel(widgetX+width-1, widgetY, 0,255,0);
-    matrix->SetPixel(widgetX, widgetY+height-1, 0,0,255);
-    matrix->SetPixel(widgetX+width-1, widgetY+height-1, 255,255,255);
+    surface->SetPixel(0, 0, 255,0,0);
+    surface->SetPixel(width-1, 0, 0,255,0);
+    surface->SetPixel(0, height-1, 0,0,255);
+    surface->SetPixel(width-1, height-1, 255,255,255);
+  }
+
+  present();
+}
+
+// Composite a region of our surface (in widget coordinates)
+// to the display, defaulting to the entire surface
+void DashboardWidget::present(int x, int y, int w, int h)
+{
+  if (surface == NULL)
+    return;
+
+  if (w < 0) w = surface->width();
+  if (h < 0) h = surface->height();
+
+  if (manager) {
+    manager->composite(widgetX + x, widgetY + y, w, h);
+    return;
+  }
+
+  // Unmanaged widgets are drawn directly
+  if (!active)
+    return;
+  for (auto sy = y; sy < y + h; sy++) {
+    for (auto sx = x; sx < x + w; sx++) {
+      if (!surface->isOpaque(sx, sy))
+        continue;
+      auto rgb = surface->getPixel(sx, sy);
+      canvas->SetPixel(widgetX + sx, widgetY + sy, rgb[0], rgb[1], rgb[2]);
+    }
   }
 }
 
 // TODO: Render an text-specific black clearing box
 int DashboardWidget::renderText()
 {
+  TRACE_SPAN_ARG("renderText", name);
   Color color;
   int16_t offset;
   bool localDebug = false; //true;
 
-  // Verify initialization & active status
-  if (!tInit) {
+  // Verify initialization
+  if (!tInit || surface == NULL) {
     _error("renderText(%s) called without config, aborting", name);
     return 0;
   }
-  else if (!active) {
-    return 0;
-  }
 
   /* Old text scroll code lived here */
   uint8_t textLen = strlen(tData);
   uint16_t renderLen;
+  TextRun *run = NULL;
+
+  // Calculate color, apply upper bound on channels
+  // Note: This currently only supports upper-bounds levels
+  if (stale) {
+    color = Color(colorTextDark);
+  }
+  else if (tAlertLevel > 0.00000001 && atof(tData) > tAlertLevel) {
+    color = Color(tAlertColor);
+  }
+  else {
+    color = Color(tColor);
+  }
+  color.r = std::min(color.r + tTempBrightness, 255);
+  color.g = std::min(color.g + tTempBrightness, 255);
+  color.b = std::min(color.b + tTempBrightness, 255);
 
-  if (tVarWidth) {
+  // Use a cached rasterized run when possible, which also
+  // gives us the rendered length without another pass
+  if (!customTextRender && !debug) {
+    run = tCache.lookup(tData, tFont, color, tAlign, tVarWidth);
+    renderLen = run->renderLen;
+  }
+  else if (tVarWidth) {
     renderLen = textRenderLength(tData, tFont);
   } else {
     // Font width set to width of rendered glyph
@@ -505,23 +718,27 @@ int DashboardWidget::renderText()
     return 0;
   }
 
+  // Text that doesn't fit is scrolled as a marquee
+  tScrolling = (tScroll && run && offset >= 0 && offset < width &&
+      renderLen > width - offset);
+  if (tScrolling)
+  {
+    if (tScrollReset) {
+      tScrollPos = tScrollCount = 0;
+      tNextScrollTime = steady_clock::now() + WIDGET_SCROLL_HOLD;
+      tScrollReset = false;
+    }
+    tScrollRun = run;
+    tScrollX = offset;
+    renderScrollText();
+    return 0;
+  }
+
   if (offset < 0) {
     _warn("text length during alignment exceeds limits, may be truncated");
     offset = 0;
   }
 
-  // Calculate color, apply upper bound on channels
-  // Note: This currently only supports upper-bounds levels
-  if (tAlertLevel > 0.00000001 && atof(tData) > tAlertLevel) {
-    color = Color(tAlertColor);
-  }
-  else {
-    color = Color(tColor);
-  }
-  color.r = std::min(color.r + tTempBrightness, 255);
-  color.g = std::min(color.g + tTempBrightness, 255);
-  color.b = std::min(color.b + tTempBrightness, 255);
-
   if (debug && localDebug)
   {
     _debug("renderText(%s) = [%s]", name, tData);
@@ -529,53 +746,119 @@ int DashboardWidget::renderText()
       widgetX, tX, textLen, renderLen, offset);
 
     // yellow top-left
-    matrix->SetPixel(widgetX + offset, widgetY, 64, 64, 0);
-    matrix->SetPixel(widgetX + offset, widgetY + tFont->height-1,
+    surface->SetPixel(offset, 0, 64, 64, 0);
+    surface->SetPixel(offset, tFont->height-1,
       0, 64, 64); // cyan bottom-left
-    matrix->SetPixel(widgetX + offset + renderLen - 1, widgetY,
+    surface->SetPixel(offset + renderLen - 1, 0,
       64, 0, 64); // violet top-right
-    matrix->SetPixel(widgetX + offset + renderLen - 1,
-      widgetY + tFont->height-1, 64, 32, 64); // pink bottom-right
+    surface->SetPixel(offset + renderLen - 1,
+      tFont->height-1, 64, 32, 64); // pink bottom-right
   }
 
   // Call the custom text renderer, if set
-  if (customTextRender)
-    customTextRender(widgetX + offset, widgetY +
-        tY, color, tData, tFont, tVarWidth);
+  if (run)
+    run->blit(surface, offset, tY);
+  else if (customTextRender)
+    customTextRender(offset, tY, color, tData, tFont,
+        tVarWidth, surface);
   else
-    drawText(widgetX + offset, widgetY + tY, color,
-        tData, tFont, tVarWidth, debug);
+    drawText(offset, tY, color, tData, tFont,
+        tVarWidth, debug, surface);
 
   return 0;
 }
 
+// Render the visible window of scrolling text into our
+// surface, from the text raster rendered by renderText()
+void DashboardWidget::renderScrollText()
+{
+  uint16_t cycle = tScrollRun->renderLen + WIDGET_SCROLL_GAP;
+  int16_t visible = width - tScrollX;
+  int16_t remaining = cycle - tScrollPos;
+
+  // Clear the text area, keeping our opaque background
+  surface->clearRect(tScrollX, 0, visible, surface->height());
+  drawRect(tScrollX, 0, visible, height+1, colorBlack, surface);
+
+  // Draw our text, and the start of the next pass after the gap
+  tScrollRun->blit(surface, tScrollX, tY, tScrollPos, visible);
+  if (remaining < visible)
+    tScrollRun->blit(surface, tScrollX + remaining, tY, 0,
+        visible - remaining);
+}
+
+// Advance scrolling text on a frame deadline.  If we are late
+// we step by the number of frames missed, so the scroll speed
+// stays constant even if our frame rate does not.
+void DashboardWidget::checkScrollUpdate()
+{
+  if (!tScrolling)
+    return;
+
+  auto now = steady_clock::now();
+  if (now < tNextScrollTime)
+    return;
+
+  uint16_t cycle = tScrollRun->renderLen + WIDGET_SCROLL_GAP;
+  auto steps = 1 + (now - tNextScrollTime) / tScrollPeriod;
+  tNextScrollTime += steps * tScrollPeriod;
+
+  // Hold at the start of each pass
+  if (tScrollPos + steps >= cycle) {
+    tScrollPos = 0;
+    tScrollCount++;
+    tNextScrollTime = now + WIDGET_SCROLL_HOLD;
+  } else {
+    tScrollPos += steps;
+  }
+
+  renderScrollText();
+  present(tScrollX, 0, width - tScrollX, surface->height());
+}
+
 // TODO: Render an icon-specific black clearing box
 void DashboardWidget::renderIcon()
 {
-  if (!iInit || iImage == NULL) {
+  TRACE_SPAN_ARG("renderIcon", name);
+  if (!iInit || iImage == NULL || surface == NULL) {
     _error("renderIcon(%s) called without config and/or image, aborting", name);
     return;
   }
 
-  if (!active)
+  drawIcon(iX, iY, iWidth, iHeight, iImage, surface);
+}
+
+// Render a subset of icon pixels, given as pixel indexes
+// into our icon image (eg: pixels changed by an animation)
+void DashboardWidget::renderIconPixels(const std::vector<uint16_t>& pixels)
+{
+  if (!iInit || iImage == NULL || surface == NULL || pixels.empty())
     return;
 
-  drawIcon(widgetX + iX, widgetY + iY, iWidth,
-      iHeight, iImage);
+  // Composite the bounds of the changed pixels once
+  int minX = INT_MAX, minY = INT_MAX, maxX = INT_MIN, maxY = INT_MIN;
+  for (auto idx : pixels) {
+    const uint8_t *rgb = iImage + 3 * idx;
+    int x = iX + idx % iWidth, y = iY + idx / iWidth;
+    surface->SetPixel(x, y, rgb[0], rgb[1], rgb[2]);
+    minX = std::min(minX, x);
+    minY = std::min(minY, y);
+    maxX = std::max(maxX, x);
+    maxY = std::max(maxY, y);
+  }
+  present(minX, minY, maxX - minX + 1, maxY - minY + 1);
 }
 
 // Clear the icon
 void DashboardWidget::clearIcon()
 {
-  if (!iInit) {
+  if (!iInit || surface == NULL) {
     _error("clearIcon(%s) called without config, aborting", name);
     return;
   }
 
-  if (!active)
-    return;
-
-  drawRect(widgetX + iX, widgetY + iY, iWidth, iHeight, colorBlack);
+  drawRect(iX, iY, iWidth, iHeight, colorBlack, surface);
+  present(iX, iY, iWidth, iHeight);
 }
 
 /*
@@ -605,14 +888,21 @@ void DashboardWidget::resetBrightness(brightType bType = BRIGHT_TEXT)
 */
 void DashboardWidget::updateBrightness()
 {
+  bool changed = false;
+
   if (iBrightness != brightness + iTempBrightness) {
     iBrightness = brightness + iTempBrightness;
     renderIcon();
+    changed = true;
   }
   if (tBrightness != brightness + tTempBrightness) {
     tBrightness = brightness + tTempBrightness;
     renderText();
+    changed = true;
   }
+
+  if (changed)
+    present();
 }
 
 // Checks if temporary brightness duration has elapsed and reset if necessary
@@ -625,7 +915,7 @@ void DashboardWidget::checkResetBrightness()
     _log("- resetting brightness");
     resetBrightness(BRIGHT_BOTH);
     iTempBrightness = tTempBrightness = 0;
-    render();
+    markDirty();
   }
 }
 
@@ -657,8 +947,6 @@ void DashboardWidget::checkResetActive()
     _log("- resetting active to: %d", !(active));
     tempActive = false;
     setActive(!(active));
-    clear();
-    render();
   }
 }
 
@@ -679,6 +967,20 @@ void DashboardWidget::setResetActiveTime(milliseconds delay)
 }
 
 // Virtual method, called from WidgetManager
-// Standard DashboardWidgets do not have any updating actions
+// Standard DashboardWidgets only update scrolling text
 // This is overridden in any child classes that support this
-void DashboardWidget::checkUpdate() {}
+void DashboardWidget::checkUpdate() {
+  checkScrollUpdate();
+}
+
+// Time until our next scheduled update, used to
+// set how long the main loop can wait for messages
+milliseconds DashboardWidget::nextUpdateIn()
+{
+  if (!tScrolling)
+    return WIDGET_IDLE_PERIOD;
+
+  auto wait = std::chrono::duration_cast<milliseconds>(
+      tNextScrollTime - steady_clock::now());
+  return std::clamp(wait, 0ms, milliseconds(WIDGET_IDLE_PERIOD));
+}
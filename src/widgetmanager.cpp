@@ -1,4 +1,7 @@
 #include "widgetmanager.h"
+#include "logger.h"
+
+#include <algorithm>
 
 WidgetManager::WidgetManager() {}
 
@@ -11,17 +14,158 @@ uint16_t WidgetManager::size(void) {
 }
 
 void WidgetManager::addWidget(DashboardWidget *widget) {
+  if (widgets.size() >= MAX_WIDGETS) {
+    _error("unable to add widget, maximum of %d reached", MAX_WIDGETS);
+    return;
+  }
   widgets.push_back(widget);
+  widget->setManager(this);
+  visibilityInit = false;
+
+  // Keep our layers in z-order, widgets with the same
+  // z-order stack in the order they were added
+  // Note: Any z-order must be set before adding the widget
+  auto pos = std::upper_bound(layers.begin(), layers.end(), widget,
+    [](DashboardWidget *a, DashboardWidget *b) {
+      return a->getZOrder() < b->getZOrder();
+    });
+  layers.insert(pos, widget);
+}
+
+// Composite to a canvas other than the display, eg. the
+// cached canvas of a page
+void WidgetManager::setTarget(rgb_matrix::Canvas *out)
+{
+  target = out;
+}
+
+// Check if any of our widgets have received data
+bool WidgetManager::hasData(void)
+{
+  for (auto *widget : widgets) {
+    if (widget->hasData())
+      return true;
+  }
+  return false;
+}
+
+// Composite a region of the display from our widget surfaces
+//
+// Each pixel is taken from the top-most active widget that has
+// drawn there.  Pixels inside a widget's surface that no active
+// widget covers are cleared, anything outside all widgets (eg:
+// the clock) is left untouched.
+void WidgetManager::composite(int x, int y, int w, int h)
+{
+  DashboardWidget *region[MAX_WIDGETS];
+  uint8_t count = 0;
+  rgb_matrix::Canvas *out = target ? target : canvas;
+
+  // Clip to the display
+  x = std::max(x, 0);
+  y = std::max(y, 0);
+  w = std::min(w, out->width() - x);
+  h = std::min(h, out->height() - y);
+  if (w <= 0 || h <= 0)
+    return;
+
+  // Find widgets overlapping our region, bottom to top
+  for (auto layer : layers) {
+    auto surface = layer->getSurface();
+    if (surface == NULL)
+      continue;
+    if (layer->getX() < x + w && layer->getX() + surface->width() > x &&
+        layer->getY() < y + h && layer->getY() + surface->height() > y)
+      region[count++] = layer;
+  }
+
+  for (auto py = y; py < y + h; py++) {
+    for (auto px = x; px < x + w; px++)
+    {
+      bool covered = false, drawn = false;
+      for (auto i = count - 1; i >= 0 && !drawn; i--)
+      {
+        auto layer = region[i];
+        if (!layer->contains(px, py))
+          continue;
+        covered = true;
+        if (!layer->isActive())
+          continue;
+
+        auto lx = px - layer->getX(), ly = py - layer->getY();
+        auto surface = layer->getSurface();
+        if (surface->isOpaque(lx, ly)) {
+          auto rgb = surface->getPixel(lx, ly);
+          out->SetPixel(px, py, rgb[0], rgb[1], rgb[2]);
+          drawn = true;
+        }
+      }
+
+      if (covered && !drawn)
+        out->SetPixel(px, py, 0, 0, 0);
+    }
+  }
+}
+
+// Check if a widget is fully covered by an active
+// widget stacked above it
+bool WidgetManager::isOccluded(DashboardWidget *widget)
+{
+  for (auto *other : widgets) {
+    if (other != widget && other->isActive() &&
+        other->getZOrder() > widget->getZOrder() &&
+        other->covers(widget))
+      return true;
+  }
+  return false;
+}
+
+// Recalculate which widgets are visible, only done
+// when the active state of any widget has changed
+void WidgetManager::updateVisibility(void)
+{
+  uint32_t mask = 0;
+  for (size_t i = 0; i < widgets.size(); i++) {
+    if (widgets[i]->isActive())
+      mask |= (1 << i);
+  }
+
+  if (mask == activeMask && visibilityInit)
+    return;
+  activeMask = mask;
+  visibilityInit = true;
+
+  for (auto *widget : widgets) {
+    bool visible = widget->isActive() && !isOccluded(widget);
+    if (visible != widget->isVisible())
+      widget->setVisible(visible);
+  }
 }
 
 // Check to see any widgets need updating
 // Called in the main application loop
+//
+// Hidden or occluded widgets are skipped, they
+// catch up when they become visible again
 void WidgetManager::checkUpdate(void) {
+  updateVisibility();
   for (auto i = 0; i < widgets.size(); i++) {
-    widgets[i]->checkUpdate();
+    if (widgets[i]->isVisible())
+      widgets[i]->checkUpdate();
   }
 }
 
+// Time until the next scheduled update of any visible widget
+milliseconds WidgetManager::nextUpdateIn(void)
+{
+  milliseconds wait = WIDGET_IDLE_PERIOD;
+  for (auto *widget : widgets) {
+    if (widget->isVisible())
+      wait = std::min(wait, widget->nextUpdateIn());
+  }
+  return wait;
+}
+
 void WidgetManager::checkResetUpdateBrightness(bool force)
 {
   for (auto i = 0; i < widgets.size(); i++)
@@ -34,6 +178,15 @@ void WidgetManager::checkResetUpdateBrightness(bool force)
   }
 }
 
+// Render widgets updated since the last frame, called
+// once per frame after pending messages are handled
+void WidgetManager::renderDirty(void) {
+  for (auto *widget : widgets) {
+    if (widget->isDirty())
+      widget->render();
+  }
+}
+
 void WidgetManager::displayDashboard(void) {
   for (auto i = 0; i < widgets.size(); i++) {
     widgets[i]->render();